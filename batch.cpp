@@ -0,0 +1,167 @@
+#include "header.h"
+#include <csignal>
+#include <cstring>
+
+namespace {
+
+volatile sig_atomic_t stopRequested = 0;
+
+void requestStop(int) { stopRequested = 1; }
+
+const long pageKilobytes = sysconf(_SC_PAGESIZE) / 1024;
+
+template<typename... Values>
+void appendFormat(string& out, const char* format, Values... values) {
+    char text[64];
+    int length = snprintf(text, sizeof(text), format, values...);
+    out.append(text, min<size_t>(max(length, 0), sizeof(text) - 1));
+}
+
+void appendJsonString(string& out, const char* text) {
+    out += '"';
+    for (const char* c = text; *c; c++) {
+        unsigned char byte = (unsigned char)*c;
+        if (byte == '"' || byte == '\\') {
+            out += '\\';
+            out += (char)byte;
+        } else if (byte < 0x20) {
+            appendFormat(out, "\\u%04x", byte);
+        } else {
+            out += (char)byte;
+        }
+    }
+    out += '"';
+}
+
+// Quoted only when the field needs it, with quotes doubled (RFC 4180)
+void appendCsvField(string& out, const char* text) {
+    if (strpbrk(text, ",\"\r\n") == nullptr) {
+        out += text;
+        return;
+    }
+    out += '"';
+    for (const char* c = text; *c; c++) {
+        if (*c == '"') out += '"';
+        out += *c;
+    }
+    out += '"';
+}
+
+}
+
+bool parseBatchFormat(const string& name, BatchFormat& format) {
+    if (name == "jsonl" || name == "json") format = BatchJsonLines;
+    else if (name == "csv") format = BatchCsv;
+    else return false;
+    return true;
+}
+
+BatchWriter::BatchWriter(FILE* out, BatchFormat format, size_t topProcesses)
+    : out(out), format(format), topProcesses(topProcesses), headerWritten(false) {}
+
+void BatchWriter::appendJson(const SystemSnapshot& snapshot) {
+    const MemoryInfo& memory = snapshot.memInfo;
+    const DiskInfo& disk = snapshot.diskInfo;
+    appendFormat(buffer, "{\"time\":%.3f,\"cpu\":%.2f", snapshot.wallTime, snapshot.cpuUsage);
+    appendFormat(buffer, ",\"temperature\":%.1f,\"fan\":%.0f", snapshot.temperature, snapshot.fanSpeed);
+    appendFormat(buffer, ",\"memory\":{\"used_mb\":%ld,\"total_mb\":%ld", memory.used_ram, memory.total_ram);
+    appendFormat(buffer, ",\"percent\":%.2f}", memory.ram_percent);
+    appendFormat(buffer, ",\"swap\":{\"used_mb\":%ld,\"total_mb\":%ld", memory.used_swap, memory.total_swap);
+    appendFormat(buffer, ",\"percent\":%.2f}", memory.swap_percent);
+    appendFormat(buffer, ",\"disk\":{\"used_gb\":%ld,\"total_gb\":%ld", disk.used_space, disk.total_space);
+    appendFormat(buffer, ",\"percent\":%.2f}", disk.usage_percent);
+
+    buffer += ",\"network\":{";
+    bool first = true;
+    for (const auto& [iface, rx] : snapshot.rx) {
+        if (!first) buffer += ',';
+        first = false;
+        appendJsonString(buffer, iface.c_str());
+        auto tx = snapshot.tx.find(iface);
+        auto rxRate = snapshot.rxRate.find(iface);
+        auto txRate = snapshot.txRate.find(iface);
+        appendFormat(buffer, ":{\"rx_bytes\":%u,\"tx_bytes\":%u", (unsigned)rx.bytes,
+                     tx != snapshot.tx.end() ? (unsigned)tx->second.bytes : 0u);
+        appendFormat(buffer, ",\"rx_rate\":%.1f,\"tx_rate\":%.1f}",
+                     rxRate != snapshot.rxRate.end() ? rxRate->second : 0.0f,
+                     txRate != snapshot.txRate.end() ? txRate->second : 0.0f);
+    }
+    buffer += '}';
+
+    const ProcessTable& processes = *snapshot.processes;
+    appendFormat(buffer, ",\"processes_total\":%d,\"states\":{", processes.total);
+    first = true;
+    for (int state = 0; state < (int)processes.states.size(); state++) {
+        if (processes.states[state] == 0) continue;
+        appendFormat(buffer, first ? "\"%c\":%d" : ",\"%c\":%d", state, processes.states[state]);
+        first = false;
+    }
+    buffer += "},\"processes\":[";
+    for (size_t i = 0; i < rows.size(); i++) {
+        uint32_t row = rows[i];
+        appendFormat(buffer, i ? ",{\"pid\":%d,\"ppid\":%d,\"name\":" : "{\"pid\":%d,\"ppid\":%d,\"name\":",
+                     processes.pid[row], processes.ppid[row]);
+        appendJsonString(buffer, processes.nameOf(row));
+        appendFormat(buffer, ",\"state\":\"%c\",\"cpu\":%.2f", processes.state[row], processes.cpu[row]);
+        appendFormat(buffer, ",\"rss_kb\":%lld,\"vsize_kb\":%lld,\"threads\":%d}",
+                     processes.rss[row] * pageKilobytes, processes.vsize[row] / 1024,
+                     processes.numThreads[row]);
+    }
+    buffer += "]}\n";
+}
+
+void BatchWriter::appendCsv(const SystemSnapshot& snapshot) {
+    if (!headerWritten) buffer += "time,pid,ppid,name,state,cpu_percent,rss_kb,vsize_kb,threads\n";
+    headerWritten = true;
+    const ProcessTable& processes = *snapshot.processes;
+    char time[32];
+    snprintf(time, sizeof(time), "%.3f,", snapshot.wallTime);
+    for (uint32_t row : rows) {
+        buffer += time;
+        appendFormat(buffer, "%d,%d,", processes.pid[row], processes.ppid[row]);
+        appendCsvField(buffer, processes.nameOf(row));
+        appendFormat(buffer, ",%c,%.2f", processes.state[row], processes.cpu[row]);
+        appendFormat(buffer, ",%lld,%lld,%d\n", processes.rss[row] * pageKilobytes,
+                     processes.vsize[row] / 1024, processes.numThreads[row]);
+    }
+}
+
+bool BatchWriter::write(const SystemSnapshot& snapshot) {
+    // Every process in table order, or the busiest ones first like top
+    const ProcessTable& processes = *snapshot.processes;
+    if (topProcesses >= processes.size()) {
+        rows.resize(processes.size());
+        for (size_t row = 0; row < rows.size(); row++) rows[row] = (uint32_t)row;
+    } else {
+        processes.topByCpu(topProcesses, rows);
+    }
+
+    buffer.clear();
+    if (format == BatchCsv) appendCsv(snapshot);
+    else appendJson(snapshot);
+    // One write per snapshot, flushed so a pipeline sees it straight away
+    return fwrite(buffer.data(), 1, buffer.size(), out) == buffer.size() && fflush(out) == 0;
+}
+
+bool BatchWriter::run(SystemSampler& sampler, unsigned long long count) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = requestStop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    unsigned long long written = 0;
+    while (!stopRequested && (count == 0 || written < count)) {
+        // A replay's last snapshot may be published just before it is marked finished
+        bool finished = sampler.isReplayFinished();
+        if (sampler.poll()) {
+            if (!write(sampler.current())) return false;
+            written++;
+        } else if (finished) {
+            break;
+        } else {
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+    }
+    return true;
+}
@@ -0,0 +1,250 @@
+#include "header.h"
+#include <fcntl.h>
+
+// Scan benchmark (--bench-scan, make bench). Few hosts have 100k
+// processes, so each PID list is the live PIDs repeated up to the wanted
+// size; every entry is still a real /proc/<pid>/stat read.
+//
+// Parse benchmark (--bench-parse, make bench): parseProcStat against the
+// istringstream split it replaced, over the live stat lines held in memory.
+
+namespace {
+
+constexpr int Rounds = 5; // Best of
+constexpr size_t ParsesPerRound = 200000;
+
+float bestScan(ProcessScanner& scanner, ProcessSnapshot& snapshot, const vector<int>& pids) {
+    float best = 0.0f;
+    for (int round = 0; round < Rounds; round++) {
+        scanner.scan(snapshot, pids);
+        if (round == 0 || snapshot.scanMilliseconds < best) best = snapshot.scanMilliseconds;
+    }
+    return best;
+}
+
+// The stat parser before parseProcStat: split everything after the name
+// into strings and stoll the fields the table used
+bool streamProcStat(const string& line, Proc& process) {
+    size_t nameStart = line.find('(');
+    size_t nameEnd = line.rfind(')');
+    if (nameStart == string::npos || nameEnd == string::npos) return false;
+    process.name = line.substr(nameStart + 1, nameEnd - nameStart - 1);
+
+    istringstream iss(line.substr(nameEnd + 1));
+    string field;
+    vector<string> fields;
+    while (iss >> field) fields.push_back(field);
+    if (fields.size() < 24) return false;
+    process.state = fields[0][0];
+    process.vsize = stoll(fields[20]);
+    process.rss = stoll(fields[21]);
+    process.utime = stoll(fields[11]);
+    process.stime = stoll(fields[12]);
+    return true;
+}
+
+// Every field parseProcStat fills, by its number in proc(5), printed back
+// to text for comparison with the split
+struct StatField {
+    int number;
+    string (*print)(const Proc&);
+};
+const StatField StatFields[] = {
+    {4, [](const Proc& p) { return to_string(p.ppid); }},
+    {5, [](const Proc& p) { return to_string(p.pgrp); }},
+    {6, [](const Proc& p) { return to_string(p.session); }},
+    {7, [](const Proc& p) { return to_string(p.ttyNr); }},
+    {8, [](const Proc& p) { return to_string(p.tpgid); }},
+    {9, [](const Proc& p) { return to_string(p.flags); }},
+    {10, [](const Proc& p) { return to_string(p.minflt); }},
+    {11, [](const Proc& p) { return to_string(p.cminflt); }},
+    {12, [](const Proc& p) { return to_string(p.majflt); }},
+    {13, [](const Proc& p) { return to_string(p.cmajflt); }},
+    {14, [](const Proc& p) { return to_string(p.utime); }},
+    {15, [](const Proc& p) { return to_string(p.stime); }},
+    {16, [](const Proc& p) { return to_string(p.cutime); }},
+    {17, [](const Proc& p) { return to_string(p.cstime); }},
+    {18, [](const Proc& p) { return to_string(p.priority); }},
+    {19, [](const Proc& p) { return to_string(p.nice); }},
+    {20, [](const Proc& p) { return to_string(p.numThreads); }},
+    {22, [](const Proc& p) { return to_string(p.starttime); }},
+    {23, [](const Proc& p) { return to_string(p.vsize); }},
+    {24, [](const Proc& p) { return to_string(p.rss); }},
+    {25, [](const Proc& p) { return to_string(p.rsslim); }},
+    {38, [](const Proc& p) { return to_string(p.exitSignal); }},
+    {39, [](const Proc& p) { return to_string(p.processor); }},
+    {40, [](const Proc& p) { return to_string(p.rtPriority); }},
+    {41, [](const Proc& p) { return to_string(p.policy); }},
+    {42, [](const Proc& p) { return to_string(p.blkioTicks); }},
+    {43, [](const Proc& p) { return to_string(p.guestTime); }},
+    {44, [](const Proc& p) { return to_string(p.cguestTime); }},
+};
+
+// Fields of one line that parseProcStat got wrong, with the split as the reference
+size_t countMismatches(const string& line, const Proc& parsed) {
+    size_t nameEnd = line.rfind(')');
+    istringstream iss(line.substr(nameEnd + 1));
+    string field;
+    vector<string> fields; // fields[0] is field 3, the state
+    while (iss >> field) fields.push_back(field);
+
+    size_t mismatches = 0;
+    if (parsed.name != line.substr(line.find('(') + 1, nameEnd - line.find('(') - 1)) mismatches++;
+    if (fields.empty() || parsed.state != fields[0][0]) mismatches++;
+    for (const StatField& stat : StatFields) {
+        size_t index = stat.number - 3;
+        if (index < fields.size() && stat.print(parsed) != fields[index]) mismatches++;
+    }
+    return mismatches;
+}
+
+// Best time per line of parse over every line, in nanoseconds
+template <typename Parse>
+double bestParse(const vector<string>& lines, Parse parse) {
+    size_t passes = max<size_t>(1, ParsesPerRound / lines.size());
+    Proc process;
+    double best = 0.0;
+    for (int round = 0; round < Rounds; round++) {
+        auto started = chrono::steady_clock::now();
+        for (size_t pass = 0; pass < passes; pass++) {
+            for (const string& line : lines) parse(line, process);
+        }
+        double nanoseconds = chrono::duration<double, nano>(chrono::steady_clock::now() - started).count() /
+                             (passes * lines.size());
+        if (round == 0 || nanoseconds < best) best = nanoseconds;
+    }
+    return best;
+}
+
+}
+
+bool parsePidCounts(const string& list, vector<size_t>& counts) {
+    counts.clear();
+    stringstream stream(list);
+    string item;
+    while (getline(stream, item, ',')) {
+        char* end;
+        unsigned long count = strtoul(item.c_str(), &end, 10);
+        if (item.empty() || *end != '\0' || count == 0) return false;
+        counts.push_back(count);
+    }
+    return !counts.empty();
+}
+
+bool runScanBenchmark(FILE* out, const vector<size_t>& pidCounts) {
+    ProcessScanner scanner;
+    ProcessSnapshot snapshot;
+    scanner.scan(snapshot);
+    vector<int> live;
+    for (const Proc& process : snapshot.list) live.push_back(process.pid);
+    if (live.empty()) {
+        fprintf(stderr, "No processes found in /proc\n");
+        return false;
+    }
+
+    // io_uring rows are left out where a batched scan falls back
+    scanner.setBatchReads(true);
+    scanner.scan(snapshot, live);
+    bool uring = snapshot.batchedReads;
+    string uringStatus = scanner.getReadStatus();
+    scanner.setBatchReads(false);
+
+    // Thread counts double up to the core count, and always cover the
+    // scanner's own range (1 to 4). Each is timed with stat files opened
+    // every scan and with their descriptors held (the budget RLIMIT_NOFILE
+    // allows). Plain reads make an open, read and close per file, or one
+    // pread on a held descriptor; for io_uring the syscalls are counted
+    // io_uring_enter calls.
+    int cores = (int)max(1u, thread::hardware_concurrency());
+    size_t fdLimit = ProcessScanner::statFdLimit();
+    fprintf(out, "# %zu live processes, %d cores, best of %d scans\n", live.size(), cores, Rounds);
+    fprintf(out, "# io_uring: %s\n", uringStatus.c_str());
+    fprintf(out, "# stat fds: up to %zu held\n", fdLimit);
+    fprintf(out, "%8s %8s %9s %9s %10s %8s %9s\n", "pids", "threads", "reads", "stat fds", "ms", "speedup", "syscalls");
+    vector<int> pids;
+    for (size_t count : pidCounts) {
+        pids.resize(count);
+        for (size_t i = 0; i < count; i++) pids[i] = live[i % live.size()];
+        float single = 0.0f;
+        for (int threads = 1; threads <= max(cores, 4); threads *= 2) {
+            scanner.setThreadCount(threads);
+            for (bool batched : {false, true}) {
+                if (batched && !uring) continue;
+                scanner.setBatchReads(batched);
+                for (bool keepFds : {false, true}) {
+                    if (keepFds && fdLimit == 0) continue;
+                    // Descriptors are held per PID, so a scan of the unique
+                    // PIDs opens them before the repeated list is timed
+                    scanner.setStatFdBudget(keepFds ? fdLimit : 0);
+                    if (keepFds) scanner.scan(snapshot, live);
+                    unsigned long long enterCalls = scanner.getRingEnterCalls();
+                    float milliseconds = bestScan(scanner, snapshot, pids);
+                    if (batched && !snapshot.batchedReads) {
+                        // The ring failed part way; the scanner fell back to plain reads
+                        fprintf(out, "# io_uring: %s\n", scanner.getReadStatus().c_str());
+                        uring = false;
+                        break;
+                    }
+                    // The PID list cycles through the live ones, so held descriptors
+                    // cover the same share of its entries
+                    size_t held = min((size_t)snapshot.statFds, live.size()) * count / live.size();
+                    unsigned long long syscalls =
+                        batched ? (scanner.getRingEnterCalls() - enterCalls) / Rounds : held + 3 * (count - held);
+                    if (threads == 1 && !batched && !keepFds) single = milliseconds;
+                    fprintf(out, "%8zu %8d %9s %9s %10.1f %7.2fx %9llu\n", count, threads,
+                            batched ? "io_uring" : "plain", keepFds ? "held" : "opened", milliseconds,
+                            single / milliseconds, syscalls);
+                }
+            }
+        }
+    }
+    scanner.setBatchReads(false);
+    scanner.setStatFdBudget(0);
+    return true;
+}
+
+bool runParseBenchmark(FILE* out) {
+    int procFd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    vector<int> pids;
+    if (procFd < 0 || !listProcessIds(procFd, pids)) {
+        fprintf(stderr, "Cannot list /proc\n");
+        if (procFd >= 0) close(procFd);
+        return false;
+    }
+    // Read once up front, so only parsing is timed; the newline is dropped
+    // as getline() did for the old parser
+    vector<string> lines;
+    char buffer[2048];
+    for (int pid : pids) {
+        string path = to_string(pid) + "/stat";
+        int fd = openat(procFd, path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue;
+        ssize_t length = read(fd, buffer, sizeof(buffer));
+        close(fd);
+        if (length <= 0) continue;
+        if (buffer[length - 1] == '\n') length--;
+        lines.emplace_back(buffer, length);
+    }
+    close(procFd);
+    if (lines.empty()) {
+        fprintf(stderr, "No processes found in /proc\n");
+        return false;
+    }
+
+    size_t mismatches = 0;
+    Proc process;
+    for (const string& line : lines) {
+        if (!parseProcStat(line.data(), line.size(), process)) mismatches++;
+        else mismatches += countMismatches(line, process);
+    }
+
+    double stream = bestParse(lines, [](const string& line, Proc& p) { streamProcStat(line, p); });
+    double inPlace = bestParse(lines, [](const string& line, Proc& p) { parseProcStat(line.data(), line.size(), p); });
+    fprintf(out, "# %zu stat lines, %zu fields each checked against the split: %zu mismatches\n", lines.size(),
+            size(StatFields) + 2, mismatches);
+    fprintf(out, "# best of %d rounds of %zu parses\n", Rounds, max<size_t>(1, ParsesPerRound / lines.size()) * lines.size());
+    fprintf(out, "%14s %10s %8s\n", "parser", "ns/line", "speedup");
+    fprintf(out, "%14s %10.1f %7.2fx\n", "istringstream", stream, 1.0);
+    fprintf(out, "%14s %10.1f %7.2fx\n", "parseProcStat", inPlace, stream / inPlace);
+    return mismatches == 0;
+}
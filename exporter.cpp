@@ -0,0 +1,373 @@
+#include "header.h"
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+namespace {
+
+volatile sig_atomic_t stopRequested = 0;
+
+void requestStop(int) { stopRequested = 1; }
+
+constexpr size_t MaxRequestBytes = 8192;
+const char* const ContentType = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+// Appends OpenMetrics lines to a reused string without building temporaries
+struct MetricText {
+    string& out;
+    int labels = 0;
+
+    void family(const char* name, const char* type, const char* help) {
+        out += "# TYPE ";
+        out += name;
+        out += ' ';
+        out += type;
+        out += "\n# HELP ";
+        out += name;
+        out += ' ';
+        out += help;
+        out += '\n';
+    }
+    void start(const char* name) {
+        out += name;
+        labels = 0;
+    }
+    void label(const char* key, const char* text) {
+        out += labels++ ? ',' : '{';
+        out += key;
+        out += "=\"";
+        for (const char* c = text; *c; c++) {
+            if (*c == '\\' || *c == '"') out += '\\';
+            if (*c == '\n') out += "\\n";
+            else out += *c;
+        }
+        out += '"';
+    }
+    void label(const char* key, long long number) {
+        char text[24];
+        snprintf(text, sizeof(text), "%lld", number);
+        label(key, text);
+    }
+    void value(double number) {
+        // Whole numbers (byte counts mostly) are written out in full
+        char text[40];
+        bool whole = number == floor(number) && fabs(number) < 1e15;
+        snprintf(text, sizeof(text), whole ? "%s %.0f\n" : "%s %.9g\n", labels ? "}" : "", number);
+        out += text;
+    }
+    void value(unsigned long long number) {
+        char text[32];
+        snprintf(text, sizeof(text), "%s %llu\n", labels ? "}" : "", number);
+        out += text;
+    }
+    void gauge(const char* name, double number) {
+        start(name);
+        value(number);
+    }
+};
+
+bool sendAll(int client, const char* header, size_t headerLength, const char* body, size_t bodyLength) {
+    struct iovec parts[2] = {{(void*)header, headerLength}, {(void*)body, bodyLength}};
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = parts;
+    message.msg_iovlen = 2;
+    while (parts[0].iov_len + parts[1].iov_len > 0) {
+        ssize_t sent = sendmsg(client, &message, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        for (struct iovec& part : parts) {
+            size_t used = min((size_t)sent, part.iov_len);
+            part.iov_base = (char*)part.iov_base + used;
+            part.iov_len -= used;
+            sent -= used;
+        }
+        if (parts[0].iov_len == 0) {
+            message.msg_iov = &parts[1];
+            message.msg_iovlen = 1;
+        }
+    }
+    return true;
+}
+
+}
+
+MetricsExporter::MetricsExporter(size_t topProcesses) : listener(-1), topProcesses(topProcesses), status("Not listening") {}
+
+MetricsExporter::~MetricsExporter() { close(); }
+
+bool MetricsExporter::listen(const string& address) {
+    close();
+    string path;
+    if (address.compare(0, 5, "unix:") == 0) path = address.substr(5);
+    else if (!address.empty() && address[0] == '/') path = address;
+
+    if (!path.empty()) {
+        struct sockaddr_un local;
+        memset(&local, 0, sizeof(local));
+        local.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(local.sun_path)) {
+            status = "Socket path too long: " + path;
+            return false;
+        }
+        memcpy(local.sun_path, path.c_str(), path.size() + 1);
+        // A socket left behind by an earlier run would make bind() fail
+        struct stat existing;
+        if (lstat(path.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode)) unlink(path.c_str());
+        listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listener < 0 || bind(listener, (struct sockaddr*)&local, sizeof(local)) < 0 || ::listen(listener, 16) < 0) {
+            status = "Cannot listen on " + path + ": " + strerror(errno);
+            close();
+            return false;
+        }
+        unixPath = path;
+        status = "Serving on unix:" + path;
+        return true;
+    }
+
+    string host = "127.0.0.1", port = address;
+    size_t colon = address.rfind(':');
+    if (colon != string::npos) {
+        host = address.substr(0, colon);
+        port = address.substr(colon + 1);
+        if (host.size() >= 2 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+    }
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+    struct addrinfo* found = nullptr;
+    int error = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &found);
+    if (error != 0) {
+        status = "Bad address " + address + ": " + gai_strerror(error);
+        return false;
+    }
+    for (struct addrinfo* candidate = found; candidate != nullptr; candidate = candidate->ai_next) {
+        listener = socket(candidate->ai_family, candidate->ai_socktype | SOCK_CLOEXEC, candidate->ai_protocol);
+        if (listener < 0) continue;
+        int reuse = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (bind(listener, candidate->ai_addr, candidate->ai_addrlen) == 0 && ::listen(listener, 16) == 0) break;
+        error = errno;
+        ::close(listener);
+        listener = -1;
+    }
+    freeaddrinfo(found);
+    if (listener < 0) {
+        status = "Cannot listen on " + address + ": " + strerror(error);
+        return false;
+    }
+    status = "Serving on " + address;
+    return true;
+}
+
+void MetricsExporter::close() {
+    if (listener >= 0) ::close(listener);
+    listener = -1;
+    if (!unixPath.empty()) unlink(unixPath.c_str());
+    unixPath.clear();
+}
+
+void MetricsExporter::render(const SystemSnapshot& snapshot) {
+    body.clear();
+    MetricText text{body};
+
+    text.family("monitor_cpu_usage_ratio", "gauge", "Share of CPU time in use over the last sample.");
+    text.gauge("monitor_cpu_usage_ratio", snapshot.cpuUsage / 100.0);
+    text.family("monitor_cpu_temperature_celsius", "gauge", "CPU temperature.");
+    text.gauge("monitor_cpu_temperature_celsius", snapshot.temperature);
+    text.family("monitor_fan_speed_rpm", "gauge", "First fan's speed.");
+    text.gauge("monitor_fan_speed_rpm", snapshot.fanSpeed);
+
+    // MemoryInfo and DiskInfo are in MiB and GiB
+    const double MiB = 1024.0 * 1024.0, GiB = MiB * 1024.0;
+    text.family("monitor_memory_total_bytes", "gauge", "Installed RAM.");
+    text.gauge("monitor_memory_total_bytes", snapshot.memInfo.total_ram * MiB);
+    text.family("monitor_memory_used_bytes", "gauge", "RAM in use, not counting buffers and cache.");
+    text.gauge("monitor_memory_used_bytes", snapshot.memInfo.used_ram * MiB);
+    text.family("monitor_swap_total_bytes", "gauge", "Swap space.");
+    text.gauge("monitor_swap_total_bytes", snapshot.memInfo.total_swap * MiB);
+    text.family("monitor_swap_used_bytes", "gauge", "Swap space in use.");
+    text.gauge("monitor_swap_used_bytes", snapshot.memInfo.used_swap * MiB);
+    text.family("monitor_disk_total_bytes", "gauge", "Size of the root filesystem.");
+    text.gauge("monitor_disk_total_bytes", snapshot.diskInfo.total_space * GiB);
+    text.family("monitor_disk_used_bytes", "gauge", "Space in use on the root filesystem.");
+    text.gauge("monitor_disk_used_bytes", snapshot.diskInfo.used_space * GiB);
+
+    // Interface counters come from 32-bit fields and wrap like a counter reset
+    struct InterfaceCounter {
+        const char* family;
+        const char* sample;
+        const char* help;
+        bool receive;
+        int field;
+    };
+    static const InterfaceCounter counters[] = {
+        {"monitor_network_receive_bytes", "monitor_network_receive_bytes_total", "Bytes received.", true, 0},
+        {"monitor_network_receive_packets", "monitor_network_receive_packets_total", "Packets received.", true, 1},
+        {"monitor_network_receive_errors", "monitor_network_receive_errors_total", "Receive errors.", true, 2},
+        {"monitor_network_receive_drops", "monitor_network_receive_drops_total", "Received packets dropped.", true, 3},
+        {"monitor_network_transmit_bytes", "monitor_network_transmit_bytes_total", "Bytes sent.", false, 0},
+        {"monitor_network_transmit_packets", "monitor_network_transmit_packets_total", "Packets sent.", false, 1},
+        {"monitor_network_transmit_errors", "monitor_network_transmit_errors_total", "Transmit errors.", false, 2},
+        {"monitor_network_transmit_drops", "monitor_network_transmit_drops_total", "Sent packets dropped.", false, 3},
+    };
+    for (const InterfaceCounter& counter : counters) {
+        text.family(counter.family, "counter", counter.help);
+        auto emit = [&](const string& iface, const auto& stats) {
+            int fields[sizeof(stats) / sizeof(int)];
+            memcpy(fields, &stats, sizeof(fields));
+            text.start(counter.sample);
+            text.label("interface", iface.c_str());
+            text.value((unsigned long long)(unsigned int)fields[counter.field]);
+        };
+        if (counter.receive) {
+            for (const auto& [iface, stats] : snapshot.rx) emit(iface, stats);
+        } else {
+            for (const auto& [iface, stats] : snapshot.tx) emit(iface, stats);
+        }
+    }
+    text.family("monitor_network_receive_rate_bytes", "gauge", "Bytes received per second over the last sample.");
+    for (const auto& [iface, rate] : snapshot.rxRate) {
+        text.start("monitor_network_receive_rate_bytes");
+        text.label("interface", iface.c_str());
+        text.value(rate);
+    }
+    text.family("monitor_network_transmit_rate_bytes", "gauge", "Bytes sent per second over the last sample.");
+    for (const auto& [iface, rate] : snapshot.txRate) {
+        text.start("monitor_network_transmit_rate_bytes");
+        text.label("interface", iface.c_str());
+        text.value(rate);
+    }
+
+    const ProcessTable& processes = *snapshot.processes;
+    text.family("monitor_processes", "gauge", "Processes by state.");
+    for (int state = 0; state < (int)processes.states.size(); state++) {
+        if (processes.states[state] == 0) continue;
+        const char letter[2] = {(char)state, '\0'};
+        text.start("monitor_processes");
+        text.label("state", letter);
+        text.value((double)processes.states[state]);
+    }
+    text.family("monitor_scan_duration_seconds", "gauge", "Wall time of the last /proc scan.");
+    text.gauge("monitor_scan_duration_seconds", processes.scanMilliseconds / 1000.0);
+    if (processes.forkCount + processes.exitCount > 0) {
+        text.family("monitor_process_forks", "counter", "Processes created, from proc connector events.");
+        text.start("monitor_process_forks_total");
+        text.value(processes.forkCount);
+        text.family("monitor_process_exits", "counter", "Processes exited, from proc connector events.");
+        text.start("monitor_process_exits_total");
+        text.value(processes.exitCount);
+    }
+
+    // Only the heaviest processes by CPU or by memory get their own series,
+    // so the scrape size stays bounded on hosts with many processes
+    processes.topByCpu(topProcesses, byCpu);
+    processes.topByRss(topProcesses, byRss);
+    chosen.assign(processes.size(), 0);
+    exported.clear();
+    for (const vector<uint32_t>* ranking : {&byCpu, &byRss}) {
+        for (uint32_t row : *ranking) {
+            if (chosen[row]) continue;
+            chosen[row] = 1;
+            exported.push_back(row);
+        }
+    }
+    sort(exported.begin(), exported.end(), [&processes](uint32_t a, uint32_t b) { return processes.pid[a] < processes.pid[b]; });
+    text.family("monitor_process_series_omitted", "gauge", "Processes left out of the per-process series.");
+    text.gauge("monitor_process_series_omitted", (double)(processes.size() - exported.size()));
+
+    static const double pageSize = (double)sysconf(_SC_PAGESIZE);
+    static const double clockTicks = (double)sysconf(_SC_CLK_TCK);
+    auto processFamily = [&](const char* family, const char* sample, const char* type, const char* help,
+                             auto&& valueOf) {
+        text.family(family, type, help);
+        for (uint32_t row : exported) {
+            text.start(sample);
+            text.label("pid", (long long)processes.pid[row]);
+            text.label("name", processes.nameOf(row));
+            text.value((double)valueOf(row));
+        }
+    };
+    processFamily("monitor_process_cpu_usage_ratio", "monitor_process_cpu_usage_ratio", "gauge",
+                  "CPU time used over the last sample, in cores.",
+                  [&](uint32_t row) { return processes.cpu[row] / 100.0; });
+    processFamily("monitor_process_cpu_seconds", "monitor_process_cpu_seconds_total", "counter",
+                  "User and system CPU time since the process started.",
+                  [&](uint32_t row) { return (processes.utime[row] + processes.stime[row]) / clockTicks; });
+    processFamily("monitor_process_resident_memory_bytes", "monitor_process_resident_memory_bytes", "gauge",
+                  "Resident set size.", [&](uint32_t row) { return processes.rss[row] * pageSize; });
+    processFamily("monitor_process_virtual_memory_bytes", "monitor_process_virtual_memory_bytes", "gauge",
+                  "Virtual memory size.", [&](uint32_t row) { return (double)processes.vsize[row]; });
+    processFamily("monitor_process_threads", "monitor_process_threads", "gauge", "Threads in the process.",
+                  [&](uint32_t row) { return processes.numThreads[row]; });
+    body += "# EOF\n";
+}
+
+void MetricsExporter::serveClient(int client) {
+    // A stalled client can hold up the loop for at most these timeouts
+    struct timeval timeout = {1, 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    request.clear();
+    char chunk[1024];
+    while (request.find("\r\n\r\n") == string::npos && request.size() < MaxRequestBytes) {
+        ssize_t length = recv(client, chunk, sizeof(chunk), 0);
+        if (length < 0 && errno == EINTR) continue;
+        if (length <= 0) return;
+        request.append(chunk, length);
+    }
+
+    bool head = request.compare(0, 5, "HEAD ") == 0;
+    bool get = request.compare(0, 4, "GET ") == 0;
+    size_t targetStart = request.find(' ') + 1;
+    size_t targetEnd = request.find_first_of(" ?\r", targetStart);
+    string_view target = string_view(request).substr(targetStart, targetEnd - targetStart);
+
+    const char* result = "200 OK";
+    const char* type = ContentType;
+    string_view payload = body;
+    if (!get && !head) {
+        result = "405 Method Not Allowed";
+        payload = "Only GET and HEAD are supported\n";
+    } else if (target != "/metrics" && target != "/") {
+        result = "404 Not Found";
+        payload = "Metrics are at /metrics\n";
+    } else if (body.empty()) {
+        result = "503 Service Unavailable";
+        payload = "No snapshot yet\n";
+    }
+    if (payload.data() != body.data()) type = "text/plain; charset=utf-8";
+    char header[256];
+    int headerLength = snprintf(header, sizeof(header),
+                                "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                                result, type, payload.size());
+    sendAll(client, header, headerLength, payload.data(), head ? 0 : payload.size());
+}
+
+void MetricsExporter::run(SystemSampler& sampler) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = requestStop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    struct pollfd descriptor = {listener, POLLIN, 0};
+    while (!stopRequested) {
+        if (sampler.poll()) render(sampler.current());
+        // Wake up often enough to pick up each new snapshot promptly
+        if (poll(&descriptor, 1, 50) <= 0) continue;
+        int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) continue;
+        serveClient(client);
+        ::close(client);
+    }
+}
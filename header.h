@@ -2,9 +2,11 @@
 #define header_H
 #include <pwd.h>
 #include <numeric>
+#ifndef MONITOR_HEADLESS
 #include "imgui.h"
 #include "imgui_impl_sdl.h"
 #include "imgui_impl_opengl3.h"
+#endif
 #include <stdio.h>
 #include <dirent.h>
 #include <vector>
@@ -22,7 +24,19 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <array>
 #include <sstream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+#include <string_view>
+#include <regex>
+#include <functional>
 
 using namespace std;
 
@@ -38,6 +52,462 @@ struct Proc {
     long long int rss;
     long long int utime;
     long long int stime;
+    // Remaining /proc/<pid>/stat fields, see proc(5)
+    int ppid, pgrp, session, ttyNr, tpgid;
+    unsigned int flags;
+    long long int minflt, cminflt, majflt, cmajflt;
+    long long int cutime, cstime;
+    long long int priority, nice;
+    int numThreads;
+    unsigned long long starttime;
+    unsigned long long rsslim;
+    int exitSignal, processor;
+    unsigned int rtPriority, policy;
+    unsigned long long blkioTicks;
+    long long int guestTime, cguestTime;
+    float cpuUsage;
+    // Arguments joined by spaces, filled by SystemSampler on request. Points
+    // into text the filler keeps (its cmdline cache, or the replay state)
+    // until the scan is assigned to a ProcessTable.
+    string_view cmdline;
+    // Delay accounting totals in nanoseconds, from TaskstatsCollector;
+    // NoDelay where taskstats has not reported them
+    unsigned long long cpuDelay, blkioDelay, swapinDelay, reclaimDelay;
+};
+
+// Delay total of a process taskstats gave no answer for. It sorts below
+// every real total, which the row comparison reads as signed.
+constexpr unsigned long long NoDelay = ~0ULL;
+
+// Parses the contents of /proc/<pid>/stat in place, without allocating
+// beyond what process.name may already hold. Returns false on malformed input.
+bool parseProcStat(const char* buffer, size_t length, Proc& process);
+
+// Reads /proc/<pid>/cmdline with the NUL separators turned into spaces.
+// Kernel threads have none and give an empty string.
+bool readProcessCmdline(int procFd, int pid, string& cmdline);
+
+// Appends the PIDs in a /proc directory descriptor, read from the start in
+// large getdents64 batches. Returns false if the directory cannot be read.
+bool listProcessIds(int procFd, vector<int>& pids);
+
+// A process that started and exited between two scans, seen only through
+// proc connector events
+struct ShortLivedProcess {
+    int pid, ppid;
+    string name;
+    float lifetimeMs;
+    int exitCode;
+};
+
+// Result of one pass over /proc: the process list together with the
+// state histogram and total the System window shows
+struct ProcessSnapshot {
+    vector<Proc> list;
+    array<int, 128> states{}; // Indexed by state letter; 'I' (idle) is folded into 'S' like top does
+    int total = 0;
+    float scanMilliseconds = 0.0f; // Wall time of the scan that produced this snapshot
+    int scanThreads = 1;
+    int statFds = 0, statFdBudget = 0; // Held /proc/<pid>/stat descriptors, see ProcessScanner
+    bool batchedReads = false; // Read through io_uring
+};
+
+enum ProcessColumn {
+    ColumnPid, ColumnName, ColumnState, ColumnCpu, ColumnMemory,
+    ColumnCpuDelay, ColumnIoDelay, ColumnSwapDelay, ColumnReclaimDelay
+};
+
+struct ProcessSortKey {
+    ProcessColumn column;
+    bool descending;
+};
+
+// Append-only pool of process names. A handle, once handed out, stays valid
+// and its text never moves, so the sampler can keep interning while the UI
+// reads names through handles from an already published snapshot.
+class NameInterner {
+private:
+    struct Entry {
+        char name[16]; // comm names are at most 15 characters
+        char lower[16]; // Lowercase copy for case-insensitive filtering
+    };
+    static constexpr size_t ChunkBits = 12;
+    static constexpr size_t ChunkSize = size_t(1) << ChunkBits;
+    static constexpr size_t MaxChunks = 256;
+
+    atomic<Entry*> chunks[MaxChunks];
+    atomic<uint32_t> count;
+    unordered_map<string_view, uint32_t> lookup; // Writer side only
+
+    Entry& entry(uint32_t id) const { return chunks[id >> ChunkBits].load(memory_order_acquire)[id & (ChunkSize - 1)]; }
+
+public:
+    NameInterner();
+    ~NameInterner();
+    NameInterner(const NameInterner&) = delete;
+    NameInterner& operator=(const NameInterner&) = delete;
+    uint32_t intern(const string& name);
+    const char* name(uint32_t id) const { return entry(id).name; }
+    const char* lowerName(uint32_t id) const { return entry(id).lower; }
+    size_t size() const { return count.load(memory_order_relaxed); }
+};
+
+// Column-oriented (structure of arrays) process store. Numeric columns are
+// contiguous so sorting, filtering and aggregation run as tight loops, and
+// names are NameInterner handles instead of per-row strings.
+struct ProcessTable {
+    vector<int> pid, ppid;
+    vector<char> state;
+    vector<uint32_t> name;
+    vector<long long> rss, vsize, utime, stime;
+    vector<unsigned long long> starttime;
+    vector<int> numThreads;
+    vector<float> cpu;
+    vector<unsigned long long> cpuDelay, blkioDelay, swapinDelay, reclaimDelay;
+    const NameInterner* names = nullptr;
+    // Command lines packed into one arena, each NUL-terminated; row r spans
+    // [cmdlineOffset[r], cmdlineOffset[r + 1] - 1). cmdlineLower is the
+    // same text lowercased, at the same offsets.
+    vector<uint32_t> cmdlineOffset;
+    vector<char> cmdlineText, cmdlineLower;
+
+    // Summary of the scan the rows came from
+    array<int, 128> states{}; // Indexed by state letter; 'I' (idle) is folded into 'S' like top does
+    int total = 0;
+    float scanMilliseconds = 0.0f;
+    int scanThreads = 1;
+    int statFds = 0, statFdBudget = 0;
+    bool batchedReads = false;
+    string readStatus;
+    bool eventDriven = false; // PIDs came from ProcEventListener instead of readdir
+    bool hasDelays = false; // Delay columns were filled by TaskstatsCollector
+    bool hasCmdlines = false; // Command lines were collected for this snapshot
+    string delayStatus;
+    unsigned long long forkCount = 0, exitCount = 0;
+    vector<ShortLivedProcess> shortLived; // Most recent first
+
+    // Rows matched to the process scan published before this one (snapshot
+    // sequence previousScan, 0 if none), so the UI only redoes work for rows
+    // that changed. previousRow is the row with the same pid there, or NoRow;
+    // cmdlineChanged is set unless that row is the same process (start time)
+    // with the same command line.
+    static constexpr uint32_t NoRow = UINT32_MAX;
+    unsigned long long previousScan = 0;
+    vector<uint32_t> previousRow;
+    vector<char> cmdlineChanged;
+
+    size_t size() const { return pid.size(); }
+    const char* nameOf(size_t row) const { return names->name(name[row]); }
+    const char* cmdlineOf(size_t row) const { return cmdlineText.data() + cmdlineOffset[row]; }
+    size_t cmdlineLength(size_t row) const { return cmdlineOffset[row + 1] - cmdlineOffset[row] - 1; }
+    void assign(const ProcessSnapshot& snapshot, NameInterner& interner);
+    // Fills previousRow and cmdlineChanged; rowOfPid is scratch
+    void link(const ProcessTable& previous, unsigned long long previousSequence, unordered_map<int, uint32_t>& rowOfPid);
+
+    void topByCpu(size_t count, vector<uint32_t>& rows) const;
+    void topByRss(size_t count, vector<uint32_t>& rows) const;
+};
+
+// Trigram inverted index over lowercase command lines. Documents are keyed
+// by (pid, start time) and synced from each new table: only processes that
+// appeared, exited or exec'd touch the index. When the table is linked to
+// the one synced last (ProcessTable::link()), unchanged rows are carried
+// over by row without any lookup. Exited documents are only marked dead;
+// the index is rebuilt once they outnumber the live ones.
+class CmdlineIndex {
+private:
+    struct Document {
+        int pid;
+        unsigned long long starttime;
+        string text;
+        bool live;
+        unsigned seen;
+    };
+    vector<Document> documents;
+    unordered_map<uint32_t, vector<uint32_t>> postings; // Trigram -> ascending document ids
+    unordered_map<int, uint32_t> documentOfPid; // Live documents only
+    vector<uint32_t> rowOfDocument; // Row in the last synced table, or NoRow
+    vector<uint32_t> documentOfRow; // The other way round
+    size_t deadDocuments;
+    unsigned generation;
+    vector<uint32_t> trigrams; // Scratch
+
+    static constexpr uint32_t NoRow = UINT32_MAX;
+    void addDocument(int pid, unsigned long long starttime, const char* text, size_t length);
+    void retire(uint32_t id);
+    void rebuild();
+    void syncLinked(const ProcessTable& table);
+
+public:
+    static constexpr size_t MinQuery = 3; // Shorter queries have no trigram to look up
+
+    CmdlineIndex();
+    // linked: table.previousRow refers to the table synced last
+    void sync(const ProcessTable& table, bool linked);
+    void clear();
+    // Marks matched[row] for every row of the synced table whose command line contains needle
+    void query(const string& needle, vector<signed char>& matched);
+    size_t getDocumentCount() const { return documents.size() - deadDocuments; }
+};
+
+// Display order of a ProcessTable, carried over from one snapshot to the
+// next. Between refreshes the order barely changes, so update() repairs the
+// previous permutation (pull out the rows that moved, sort just those and
+// merge them back) instead of sorting everything again. getRows() is the
+// sorted order with the filter applied, ready to be clipped by the UI.
+class ProcessView {
+private:
+    vector<ProcessSortKey> sortKeys;
+    string filter; // Lowercased unless it is a regex
+    bool filterRegex, filterCmdline;
+    regex pattern;
+    string filterError;
+    vector<signed char> nameMatches; // Per name handle: -1 not checked yet, else 0 or 1
+    CmdlineIndex cmdlineIndex;
+    unsigned long long indexedSequence;
+    // Per row: -1 not checked yet, else 0 or 1. Carried over to the next
+    // snapshot for rows whose command line did not change.
+    vector<signed char> cmdlineMatches, carriedMatches;
+    unsigned long long filteredSequence; // Snapshot cmdlineMatches belongs to; 0 if none
+    vector<uint32_t> order;
+    vector<uint32_t> rows;
+    vector<int> previousPids;
+    unordered_map<int, uint32_t> rowOfPid; // Only for tables not linked to the previous one
+    vector<uint32_t> rowOfPrevious;
+    vector<uint32_t> misfits, merged;
+    unsigned long long sequence;
+    bool sortDirty;
+    bool filterDirty;
+
+    void sortRows(const ProcessTable& table, bool fullSort);
+    void filterRows(const ProcessTable& table);
+    bool matchesName(const ProcessTable& table, uint32_t row);
+    bool matchesCmdline(const ProcessTable& table, uint32_t row);
+
+public:
+    ProcessView();
+    void setSort(const vector<ProcessSortKey>& keys);
+    void setFilter(const char* text, bool useRegex, bool matchCmdline);
+    void update(const ProcessTable& table, unsigned long long snapshotSequence);
+    const vector<uint32_t>& getRows() const { return rows; }
+    const string& getFilterError() const { return filterError; } // Empty unless the regex failed to compile
+};
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// One file for UringReader: a held descriptor read at offset 0, or, when fd
+// is -1, path opened, read and closed. result is the byte count or -errno.
+struct UringRead {
+    int fd;
+    const char* path;
+    char* buffer;
+    unsigned size;
+    int result;
+};
+
+// Reads many small files with a few io_uring_enter calls instead of an
+// open/read/close each, through the raw system calls rather than liburing.
+// Paths are opened into registered file slots and read and closed in one
+// linked chain. open() fails, and callers should read synchronously, where
+// the kernel, a seccomp filter or io_uring_disabled refuses any of this.
+// A ring is used by one thread at a time.
+class UringReader {
+private:
+    int ringFd;
+    void* sqRing;
+    size_t sqRingSize;
+    void* cqRing;
+    size_t cqRingSize;
+    io_uring_sqe* sqes;
+    size_t sqesSize;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    io_uring_cqe* cqes;
+    unsigned slots;
+    unsigned long long enterCalls;
+    string status;
+
+    io_uring_sqe* queue(unsigned& tail, uint8_t opcode, uint64_t userData);
+    bool readBatch(UringRead* reads, size_t count, int dirFd);
+
+public:
+    UringReader();
+    ~UringReader();
+    UringReader(const UringReader&) = delete;
+    UringReader& operator=(const UringReader&) = delete;
+    bool open(unsigned fileSlots); // Up to fileSlots paths per io_uring_enter
+    void close();
+    bool isOpen() const;
+    const string& getStatus() const;
+    unsigned long long getEnterCalls() const;
+    // Paths are relative to dirFd; false if the ring failed, nothing is retried
+    bool read(vector<UringRead>& reads, int dirFd);
+};
+
+// Walks /proc and parses every /proc/<pid>/stat into a ProcessSnapshot.
+// With more than one thread the PIDs are cut into chunks spread over a
+// small persistent pool; a worker that runs out of chunks steals from the
+// others, so one slow range does not hold up the whole scan.
+class ProcessScanner {
+private:
+    static constexpr size_t ChunkSize = 64;
+
+    // A /proc/<pid>/stat descriptor kept open between scans. It reads the
+    // process it was opened for until that exits (ESRCH), even if the pid is
+    // reused, so the start time only double-checks the pairing.
+    struct CachedStatFd {
+        int fd;
+        unsigned long long starttime;
+        unsigned int generation;
+    };
+
+    struct alignas(64) ScanWorker {
+        atomic<size_t> nextChunk;
+        size_t endChunk;
+        array<int, 128> states;
+        int total;
+        // Batched reads; rings are per worker since each has one user at a time
+        UringReader ring;
+        vector<UringRead> reads;
+        vector<size_t> readRows;
+        vector<char> readBuffers, readPaths;
+    };
+
+    int procFd; // Held /proc; stat files are opened relative to it
+    vector<int> pids;
+    vector<int> statFds; // Per pids[i]: held descriptor going in, the one to keep coming out, or -1
+    unordered_map<int, CachedStatFd> statFdCache;
+    size_t statFdBudget;
+    unsigned int statFdGeneration;
+    atomic<long> spareStatFds;
+    bool batchReads, ringsOpen;
+    atomic<bool> ringFailed;
+    string readStatus;
+    unique_ptr<ScanWorker[]> workers;
+    vector<thread> pool;
+    int threadCount;
+    ProcessSnapshot* target;
+
+    mutex jobMutex;
+    condition_variable jobReady, jobDone;
+    unsigned int jobGeneration;
+    int pendingWorkers;
+    bool stopping;
+
+    void listPids();
+    void scanPids(ProcessSnapshot& snapshot);
+    void scanChunks(int worker);
+    void workerLoop(int worker, unsigned int seen);
+    void stopPool();
+    void openRings();
+    void closeRings(const string& status);
+    void readBatch(ScanWorker& self, size_t begin, size_t end);
+    void updateStatFdCache(ProcessSnapshot& snapshot);
+    void closeStatFds(size_t keep);
+
+public:
+    explicit ProcessScanner(int threads = 1);
+    ~ProcessScanner();
+    void setThreadCount(int threads);
+    int getThreadCount() const;
+    // Keep up to this many stat files open between scans; 0 turns the cache off
+    void setStatFdBudget(size_t fds);
+    size_t getStatFdBudget() const;
+    static size_t statFdLimit(); // Largest budget RLIMIT_NOFILE leaves room for
+    // Read stat files through io_uring in batches, where the kernel allows it
+    void setBatchReads(bool enabled);
+    bool getBatchReads() const;
+    const string& getReadStatus() const;
+    unsigned long long getRingEnterCalls() const; // io_uring_enter calls by the current workers
+    int getProcFd() const { return procFd; }
+    void scan(ProcessSnapshot& snapshot);
+    void scan(ProcessSnapshot& snapshot, const vector<int>& knownPids);
+};
+
+// Keeps the set of live processes up to date from NETLINK_CONNECTOR
+// (CN_IDX_PROC) fork/exec/exit events, so refreshes need not rediscover it
+// through /proc. Processes that come and go between two scans are kept
+// as ShortLivedProcess records. Needs CAP_NET_ADMIN; start() returns false
+// when the connector is unavailable and callers should keep polling.
+class ProcEventListener {
+private:
+    struct PendingProcess {
+        chrono::steady_clock::time_point born;
+        int ppid;
+        char name[16];
+    };
+
+    int sock;
+    thread receiver;
+    atomic<bool> running;
+    atomic<bool> overflowed;
+
+    mutex stateMutex; // Guards everything below
+    unordered_set<int> livePids;
+    unordered_map<int, PendingProcess> unseen; // Started but not yet scanned
+    vector<ShortLivedProcess> exited;
+    unordered_set<int> exitedDuringRescan; // Exits since an overflow made a rescan due
+    unsigned long long forkCount, exitCount;
+
+    bool subscribe(bool enable);
+    void receiveLoop();
+    void handleEvent(const struct proc_event& event, const char* name);
+
+public:
+    ProcEventListener();
+    ~ProcEventListener();
+    bool start();
+    void stop();
+    bool isActive() const;
+    // Fills pids with the live set; false if events were lost and a full rescan is due
+    bool copyLivePids(vector<int>& pids);
+    void reseed(const vector<Proc>& scanned); // After a full scan made because copyLivePids() failed
+    void acknowledge(const vector<int>& requested, const vector<Proc>& scanned);
+    void takeExited(vector<ShortLivedProcess>& out);
+    unsigned long long getForkCount();
+    unsigned long long getExitCount();
+};
+
+// Per-process delay accounting (CPU run-queue, block I/O, swap-in and
+// memory reclaim waits) queried over the TASKSTATS generic netlink family.
+// Needs CAP_NET_ADMIN and kernel.task_delayacct=1; otherwise open() fails
+// or the totals stay at zero, and getStatus() says why.
+class TaskstatsCollector {
+private:
+    // Totals from the last reply per process, for rows a time-capped
+    // queryAll() did not reach
+    struct CachedDelays {
+        unsigned long long starttime;
+        unsigned long long cpu, blkio, swapin, reclaim;
+        unsigned generation;
+    };
+
+    int sock;
+    int familyId;
+    unsigned int sequence;
+    string status;
+    alignas(4) char buffer[8192];
+    unordered_map<int, CachedDelays> cache;
+    unsigned generation;
+    size_t cursor; // Where the next queryAll() starts, so every row gets its turn
+
+    bool sendRequest(int type, int command, int attribute, const void* data, int length);
+    int receiveReply();
+    int resolveFamily();
+
+public:
+    TaskstatsCollector();
+    ~TaskstatsCollector();
+    bool open();
+    void close();
+    bool isAvailable() const;
+    const string& getStatus() const;
+    bool query(Proc& process);
+    // Queries rows until budgetMs has passed, starting where the last call
+    // stopped; rows not reached keep their previous totals, and rows never
+    // answered stay at NoDelay. Returns how many rows were refreshed.
+    size_t queryAll(vector<Proc>& processes, float budgetMs);
 };
 
 struct IP4 {
@@ -47,6 +517,11 @@ struct IP4 {
 
 struct Networks {
     vector<IP4> ip4s;
+    Networks() = default;
+    Networks(const Networks& other); // Duplicates the names
+    Networks& operator=(const Networks& other);
+    Networks(Networks&& other);
+    Networks& operator=(Networks&& other);
     ~Networks();
 };
 
@@ -68,52 +543,644 @@ struct DiskInfo {
     float usage_percent;
 };
 
+// A fixed procfs file (/proc/stat, /proc/meminfo, /proc/net/dev) opened
+// once and re-read from offset 0 with pread() into a reused buffer, so each
+// sample costs a single read instead of open, fstat, read and close plus
+// stream buffers.
+class ProcFile {
+private:
+    const char* path;
+    int fd;
+    vector<char> buffer;
+    size_t length;
+
+public:
+    explicit ProcFile(const char* path);
+    ~ProcFile();
+    ProcFile(const ProcFile&) = delete;
+    ProcFile& operator=(const ProcFile&) = delete;
+    // Reads the whole file; data() is NUL-terminated and stays valid until
+    // the next read()
+    bool read();
+    const char* data() const { return buffer.data(); }
+    size_t size() const { return length; }
+};
+
 class SystemResourceTracker {
+private:
+    ProcFile meminfo{"/proc/meminfo"};
+
 public:
     MemoryInfo getMemoryInfo();
     DiskInfo getDiskInfo();
-    vector<Proc> getProcessList();
 };
 
 class CPUUsageTracker {
 private:
+    ProcFile stat{"/proc/stat"};
     CPUStats lastStats;
+    long long totalTime;
     float currentUsage;
 
+    bool readStats(CPUStats& stats);
+
 public:
     CPUUsageTracker();
     float calculateCPUUsage();
     float getCurrentUsage();
+    // Re-reads the total without moving the window calculateCPUUsage() measures
+    long long readTotalTime();
+    long long getTotalTime() const { return totalTime; } // Jiffies from the last read
 };
 
+// Per-process CPU%, computed for a whole ProcessSnapshot at once against
+// the system total CPUUsageTracker already read from /proc/stat. Each
+// update() measures over the time since the previous one.
 class ProcessUsageTracker {
     private:
-        map<int, pair<long long, long long>> lastProcessCPUTime;
-        float deltaTime;
-        float updateInterval;
-        float lastUpdateTime;
-        map<int, float> cpuUsageCache;
-    
+        // One slot per live process in an open-addressing (linear probing) table.
+        // A slot belongs to a (pid, starttime) pair, so a recycled PID never
+        // inherits the previous owner's counters.
+        struct CPUTimeEntry {
+            int pid; // EmptySlot / DeletedSlot when unused
+            unsigned int generation; // Last update() that saw this process
+            unsigned long long starttime;
+            long long lastCPUTime;
+            long long lastTotalTime;
+            float cpuUsage;
+        };
+        static constexpr int EmptySlot = 0;
+        static constexpr int DeletedSlot = -1;
+        static constexpr size_t MinCapacity = 1024;
+
+        vector<CPUTimeEntry> entries;
+        vector<CPUTimeEntry> spare; // Rehash target, kept to avoid reallocating
+        size_t liveCount;
+        size_t deletedCount;
+        unsigned int generation;
+        int numCores;
+
+        size_t findSlot(int pid) const;
+        void rehash(size_t expected);
+
     public:
         ProcessUsageTracker();
-        float calculateProcessCPUUsage(const Proc& process, float currentTime); // No change needed, just context
-        void updateDeltaTime(float dt);
+        void update(const ProcessSnapshot& snapshot, long long totalTime);
+        float getCPUUsage(int pid) const;
     };
 
 class NetworkTracker {
+private:
+    ProcFile netDev{"/proc/net/dev"};
+
 public:
     Networks getNetworkInterfaces();
-    map<string, RX> getNetworkRX();
-    map<string, TX> getNetworkTX();
+    // Both directions from one read of /proc/net/dev
+    void getNetworkStats(map<string, RX>& rxStats, map<string, TX>& txStats);
+};
+
+struct NetworkRate {
+    map<string, pair<long long, float>> lastRX, lastTX; // Last bytes, timestamp
+    map<string, float> rxRate, txRate; // Rates in bytes/sec
+    void update(const map<string, RX>& rxStats, const map<string, TX>& txStats, float time);
 };
 
+// Fixed-capacity history of the last N values. push() is O(1): it overwrites
+// the oldest slot instead of shifting, and keeps the running sum, minimum and
+// maximum (the extremes through monotonic queues of push numbers). The
+// values are the two spans [offset(), size()) and [0, offset()), oldest
+// first, which is what ImGui::PlotLines' values_offset expects.
+template<typename T, size_t N>
+class RingSeries {
+    static_assert(N > 0, "RingSeries needs room for at least one value");
+
+private:
+    // Push numbers whose values are monotonic from front to back
+    struct MonotonicQueue {
+        vector<unsigned long long> ids = vector<unsigned long long>(N);
+        size_t head = 0, count = 0;
+
+        unsigned long long front() const { return ids[head]; }
+        unsigned long long back() const { return ids[(head + count - 1) % N]; }
+        void popFront() { head = (head + 1) % N; count--; }
+        void popBack() { count--; }
+        void pushBack(unsigned long long id) { ids[(head + count++) % N] = id; }
+    };
+
+    vector<T> values;
+    unsigned long long pushes; // The value of push i lives in slot i % N
+    double total;
+    MonotonicQueue highs, lows;
+
+    const T& at(unsigned long long id) const { return values[id % N]; }
+
+public:
+    RingSeries() : values(N), pushes(0), total(0) {}
+    explicit RingSeries(const T& initial) : RingSeries() {
+        for (size_t i = 0; i < N; i++) push(initial);
+    }
+
+    void push(const T& value) {
+        unsigned long long id = pushes++;
+        if (id >= N) total -= at(id);
+        values[id % N] = value;
+        total += value;
+
+        // Drop the push that just fell out of the window, then everything
+        // the new value outranks
+        if (highs.count > 0 && highs.front() + N <= id) highs.popFront();
+        if (lows.count > 0 && lows.front() + N <= id) lows.popFront();
+        while (highs.count > 0 && !(value < at(highs.back()))) highs.popBack();
+        while (lows.count > 0 && !(at(lows.back()) < value)) lows.popBack();
+        highs.pushBack(id);
+        lows.pushBack(id);
+    }
+
+    static constexpr size_t capacity() { return N; }
+    size_t size() const { return pushes < N ? (size_t)pushes : N; }
+    bool empty() const { return pushes == 0; }
+    const T* data() const { return values.data(); }
+    size_t offset() const { return pushes < N ? 0 : (size_t)(pushes % N); } // Slot of the oldest value
+    const T& latest() const { return at(pushes - 1); }
+
+    double sum() const { return total; }
+    double mean() const { return empty() ? 0.0 : total / size(); }
+    T min() const { return empty() ? T() : at(lows.front()); }
+    T max() const { return empty() ? T() : at(highs.front()); }
+};
+
+// Single-producer / single-consumer handoff. The writer fills writeBuffer() and
+// publishes it; the reader picks up the newest published value with update().
+// Neither side ever blocks or waits for the other.
+template<typename T>
+class TripleBuffer {
+private:
+    static constexpr unsigned DirtyBit = 4;
+    T slots[3];
+    atomic<unsigned> middle;
+    unsigned front;
+    unsigned back;
+    unsigned last; // Writer side: the slot published most recently
+
+public:
+    TripleBuffer() : middle(1), front(0), back(2), last(2) {}
+    T& writeBuffer() { return slots[back]; }
+    // The writer may read back what it published last; the reader never
+    // modifies a slot, so both can read it at once
+    const T& published() const { return slots[last]; }
+    void publish() {
+        last = back;
+        back = middle.exchange(back | DirtyBit, memory_order_acq_rel) & 3;
+    }
+    bool update() {
+        if (!(middle.load(memory_order_relaxed) & DirtyBit)) return false;
+        front = middle.exchange(front, memory_order_acq_rel) & 3;
+        return true;
+    }
+    const T& read() const { return slots[front]; }
+};
+
+// Metrics kept in long-term history
+enum HistoryMetric {
+    HistoryCpu, HistoryTemperature, HistoryFan, HistoryRx, HistoryTx, HistoryMetricCount
+};
+
+struct RollupBucket {
+    float min, max, sum, last;
+    uint32_t count; // Samples in the bucket; 0 means no data
+};
+
+// One metric downsampled for plotting: a bucket average per point, oldest first
+struct HistoryPlot {
+    vector<float> values;
+    float min = 0.0f, max = 0.0f; // Extremes of the raw samples over the span
+    float bucketSeconds = 0.0f;
+};
+
+// Cascading rollup tiers of 1 s, 10 s, 1 min and 10 min buckets, each a ring
+// of BucketCount buckets holding min/max/sum/last. Every sample lands in the
+// current bucket of each tier, so add() is O(1) and memory is fixed. A plot
+// reads the finest tier that covers the span, so it never needs more than
+// BucketCount points however long the span is.
+class RollupSeries {
+public:
+    static constexpr size_t TierCount = 4;
+    static constexpr size_t BucketCount = 600;
+    static constexpr double TierSeconds[TierCount] = {1.0, 10.0, 60.0, 600.0};
+
+private:
+    struct Tier {
+        array<RollupBucket, BucketCount> buckets; // Bucket i (time / width) lives in slot i % BucketCount
+        long long newest = -1;
+    };
+    array<Tier, TierCount> tiers;
+
+public:
+    void add(double time, float value);
+    void plot(double span, HistoryPlot& out) const;
+};
+
+// Encoder/decoder state of one Gorilla-compressed stream: delta-of-delta
+// timestamps in milliseconds and XOR-compressed float values
+struct GorillaState {
+    long long time = 0, delta = 0;
+    uint32_t value = 0;
+    int leading = 32, trailing = 0; // 32 means no previous XOR window
+    size_t count = 0;
+};
+
+// Persistent per-host metric history. Every series is appended to its own
+// memory-mapped segment files, Gorilla-compressed. A segment's header holds
+// the number of committed bits and is updated only after a sample is fully
+// written, so a crash loses at most the sample being written. A restart
+// continues the newest segment while it has room; segments being written
+// are held with flock, so two instances never share one. Retention is
+// bounded per series, by segment count and by age. The plotted metrics also
+// keep their RollupSeries in a mapped <series>.rollup file, so a restart
+// maps the tiers instead of decoding every stored sample.
+class MetricStore {
+public:
+    static constexpr size_t SegmentBytes = 256 * 1024;
+    static constexpr size_t MaxSegments = 16; // Per series
+    static constexpr double MaxAgeSeconds = 7 * 24 * 3600.0;
+
+private:
+    struct Segment {
+        string path;
+        long long firstTime; // Milliseconds since the epoch
+    };
+    struct SeriesWriter {
+        vector<Segment> segments; // Oldest first; the last one is open while base is set
+        int fd = -1;
+        unsigned char* base = nullptr;
+        uint64_t position = 0; // Bits written after the header
+        GorillaState state;
+        bool resumeChecked = false; // Tried to continue the newest segment
+        int rollupFd = -1;
+        RollupSeries* rollups = nullptr; // Mapped by mapRollups(), after its file header
+    };
+
+    string directory;
+    string status;
+    unordered_map<string, SeriesWriter> writers;
+
+    bool openSegment(const string& series, SeriesWriter& writer, long long time);
+    bool reopenSegment(SeriesWriter& writer);
+    void closeSegment(SeriesWriter& writer);
+    void enforceRetention(SeriesWriter& writer, long long now);
+
+public:
+    MetricStore() : status("Closed") {}
+    ~MetricStore();
+    MetricStore(const MetricStore&) = delete;
+    MetricStore& operator=(const MetricStore&) = delete;
+
+    // Uses $XDG_DATA_HOME/system-monitor/<host>, falling back to ~/.local/share
+    bool open(const string& host);
+    void close();
+    bool isOpen() const { return !directory.empty(); }
+    const string& getStatus() const { return status; }
+
+    void append(const string& series, double time, float value);
+    // Calls visit(time, value) for the stored samples of series from about
+    // since onwards, oldest first
+    void load(const string& series, double since, const function<void(double, float)>& visit) const;
+    // The series' rollups, mapped until close() and built from the segments
+    // the first time. nullptr when the file cannot be mapped or another
+    // instance holds it.
+    RollupSeries* mapRollups(const string& series);
+};
+
+// Collectors SystemSampler runs, each on its own cadence
+enum Collector {
+    CollectorCpu, CollectorProcesses, CollectorMemory, CollectorDisk, CollectorNetwork, CollectorSensors,
+    CollectorCount
+};
+
+// Decides when each collector runs. Collector c runs at the ticks
+// start + phase + n * period on CLOCK_MONOTONIC. A late wakeup skips the
+// ticks it missed instead of shifting later ones, and a run is stamped with
+// its tick rather than the time the thread woke, so samples stay evenly
+// spaced. The sampler thread waits on a timerfd armed for the earliest
+// tick; periods and phases may be changed from any thread and take effect
+// at once.
+class CollectorScheduler {
+private:
+    array<atomic<long long>, CollectorCount> periods, phases; // Nanoseconds
+    array<long long, CollectorCount> appliedPeriods, appliedPhases, nextTicks;
+    long long startTime;
+    int timerFd; // -1 where timerfd is unavailable; waits then use poll()'s timeout
+    int wakeFd; // eventfd that interrupts a wait
+
+public:
+    static const char* const Names[CollectorCount];
+    static long long now(); // CLOCK_MONOTONIC nanoseconds
+
+    CollectorScheduler();
+    ~CollectorScheduler();
+    CollectorScheduler(const CollectorScheduler&) = delete;
+    CollectorScheduler& operator=(const CollectorScheduler&) = delete;
+    void setPeriod(Collector collector, float seconds); // At least 10 ms
+    float getPeriod(Collector collector) const;
+    void setPhase(Collector collector, float seconds); // Offset into the period
+    float getPhase(Collector collector) const;
+    void start(); // Sampler thread; every collector's first tick counts from here
+    long long getStartTime() const { return startTime; }
+    // Sampler thread. Waits for the next tick and fills due, and the tick of
+    // each due collector in ticks. false if wake() cut the wait short.
+    bool wait(array<bool, CollectorCount>& due, array<long long, CollectorCount>& ticks);
+    bool sleepUntil(long long time); // false if woken first
+    void wake(); // Any thread
+};
+
+// Everything the UI draws. Each part is filled by one collector; the parts
+// whose collector did not run keep the values it last published.
+struct SystemSnapshot {
+    unsigned long long sequence = 0;
+    array<unsigned long long, CollectorCount> collected{}; // Sequence each collector last ran in; 0 if never
+    float timestamp = 0.0f;
+    double wallTime = 0.0; // Seconds since the epoch; the recording's clock during a replay
+    string username, hostname, cpuInfo;
+    // Read-only once published. Snapshots between two process scans share
+    // the same table instead of each holding a copy.
+    shared_ptr<const ProcessTable> processes = make_shared<const ProcessTable>();
+    MemoryInfo memInfo{};
+    DiskInfo diskInfo{};
+    float cpuUsage = 0.0f;
+    float temperature = 0.0f;
+    float fanSpeed = 0.0f;
+    Networks interfaces;
+    map<string, RX> rx;
+    map<string, TX> tx;
+    map<string, float> rxRate, txRate;
+    array<HistoryPlot, HistoryMetricCount> history; // Over SystemSampler::getHistorySpan()
+    string historyStatus; // State of the on-disk MetricStore
+};
+
+// One process row as --record stores it
+struct RecordedProcess {
+    int pid, ppid;
+    char state;
+    string name, cmdline;
+    long long rss, vsize, utime, stime;
+    unsigned long long starttime;
+    int numThreads;
+    float cpu;
+    unsigned long long cpuDelay, blkioDelay, swapinDelay, reclaimDelay;
+};
+
+// What the previous record held. The recorder and the replay each keep one
+// and code every record against it.
+struct SnapshotCodecState {
+    vector<long long> scalars; // Numeric fields in record order; floats as their bits
+    vector<long long> processScalars; // The same for the process section, which not every record has
+    string username, hostname, cpuInfo, delayStatus;
+    vector<RecordedProcess> processes;
+    unordered_map<int, size_t> rowOfPid;
+    vector<ShortLivedProcess> shortLived;
+    vector<pair<string, string>> addresses; // Interface name and IPv4 address
+    map<string, RX> rx;
+    map<string, TX> tx;
+    map<string, float> rxRate, txRate;
+};
+
+// Writes every snapshot to a compact binary stream (--record). After a
+// small header, each record is a varint length and a payload holding the
+// timestamp, the collectors that ran, and then every field delta-coded
+// against the previous record: integers as zigzag varint differences, floats
+// as the varint of their bits XOR the previous bits, strings only when they
+// changed, and process rows against the previous row with the same PID. The
+// process section is left out of records where its collector did not run.
+class SnapshotRecorder {
+private:
+    FILE* file = nullptr;
+    SnapshotCodecState previous;
+    string record;
+    vector<RecordedProcess> rows;
+    unordered_map<int, size_t> rowOfPid;
+    string status = "Closed";
+
+public:
+    SnapshotRecorder() = default;
+    ~SnapshotRecorder();
+    SnapshotRecorder(const SnapshotRecorder&) = delete;
+    SnapshotRecorder& operator=(const SnapshotRecorder&) = delete;
+    bool open(const string& path);
+    void close();
+    bool isOpen() const { return file != nullptr; }
+    const string& getStatus() const { return status; }
+    void write(const SystemSnapshot& snapshot);
+};
+
+// Reads a --record stream back (--replay). The rows come out as a
+// ProcessSnapshot so the sampler publishes them through the same
+// ProcessTable::assign() as a live scan.
+class SnapshotReplay {
+private:
+    FILE* file = nullptr;
+    SnapshotCodecState previous;
+    string payload, next; // The record being decoded and the one after it
+    bool hasNext = false;
+    double startTime = 0.0; // Wall-clock seconds when the recording started
+    string status = "Closed";
+
+    bool readRecord(string& out);
+
+public:
+    SnapshotReplay() = default;
+    ~SnapshotReplay();
+    SnapshotReplay(const SnapshotReplay&) = delete;
+    SnapshotReplay& operator=(const SnapshotReplay&) = delete;
+    bool open(const string& path);
+    void close();
+    bool isOpen() const { return file != nullptr; }
+    bool finished() const { return isOpen() && !hasNext; }
+    const string& getStatus() const { return status; }
+    double getStartTime() const { return startTime; }
+    float nextTimestamp() const; // Of the record read() returns next
+    void nextCollected(array<bool, CollectorCount>& collected) const; // The same record's collectors
+    // table must be given exactly when nextCollected() includes CollectorProcesses
+    bool read(SystemSnapshot& snapshot, ProcessTable* table, ProcessSnapshot& processes);
+};
+
+// Runs the collectors on a background thread, each at the cadence its
+// CollectorScheduler entry gives it, so a slow /proc scan never stalls the
+// render loop. The UI calls poll() once per frame and then draws
+// from current(), which stays untouched until the next poll().
+class SystemSampler {
+private:
+    TripleBuffer<SystemSnapshot> buffers;
+    thread worker;
+    atomic<bool> running;
+    CollectorScheduler scheduler;
+    unsigned long long sequence;
+
+    CPUUsageTracker cpuTracker;
+    ProcessUsageTracker processTracker;
+    SystemResourceTracker resourceTracker;
+    ProcessScanner processScanner;
+    ProcessSnapshot scanned;
+    NameInterner processNames;
+    vector<shared_ptr<ProcessTable>> processTables; // Reused once no snapshot holds them
+    unordered_map<int, uint32_t> previousRowOfPid; // Scratch for ProcessTable::link()
+    atomic<int> scanThreads;
+    atomic<size_t> statFdBudget;
+    atomic<bool> batchReads;
+    ProcEventListener procEvents;
+    atomic<bool> eventTracking;
+    vector<int> livePids;
+    vector<ShortLivedProcess> shortLived;
+    TaskstatsCollector taskstats;
+    atomic<bool> delayAccounting;
+    bool taskstatsAttempted;
+    // Command lines only change on exec, so each is read once and reused
+    // while the pid, start time and name stay the same
+    struct CachedCmdline {
+        unsigned long long starttime = 0;
+        string name, text;
+        unsigned generation = 0;
+        bool settled = false; // An empty text is the real one; do not read it again
+    };
+    atomic<bool> collectCmdlines;
+    unordered_map<int, CachedCmdline> cmdlineCache;
+    unsigned cmdlineGeneration;
+    NetworkTracker networkTracker;
+    NetworkRate rateTracker;
+    array<RollupSeries, HistoryMetricCount> ownRollups; // For replays and when the store cannot map its own
+    array<RollupSeries*, HistoryMetricCount> rollups;
+    atomic<float> historySpan;
+    MetricStore historyStore;
+    SnapshotRecorder recorder;
+    SnapshotReplay replay;
+    float replaySpeed;
+    atomic<bool> replayDone;
+    function<void()> publishCallback;
+
+    void run();
+    void restoreHistory();
+    void recordHistory(const SystemSnapshot& snapshot, double time, const array<bool, CollectorCount>& due,
+                       float rxTotal, float txTotal);
+    void collect(SystemSnapshot& snapshot, const array<bool, CollectorCount>& due,
+                 const array<long long, CollectorCount>& ticks);
+    ProcessTable& nextProcessTable(SystemSnapshot& snapshot);
+    void collectProcesses(SystemSnapshot& snapshot, bool cpuRead);
+    bool collectReplay(SystemSnapshot& snapshot);
+    void updateHistory(SystemSnapshot& snapshot, double time, const array<bool, CollectorCount>& due,
+                       float& rxTotal, float& txTotal);
+
+public:
+    SystemSampler();
+    ~SystemSampler();
+    void start();
+    void stop();
+    bool poll();
+    const SystemSnapshot& current() const;
+    void setInterval(float seconds); // Runs every collector at this period, in step
+    void setPeriod(Collector collector, float seconds);
+    float getPeriod(Collector collector) const;
+    void setPhase(Collector collector, float seconds);
+    float getPhase(Collector collector) const;
+    void setScanThreads(int threads);
+    int getScanThreads() const;
+    void setStatFdBudget(size_t fds); // Clamped to ProcessScanner::statFdLimit(); 0 is off
+    size_t getStatFdBudget() const;
+    void setBatchReads(bool enabled);
+    bool getBatchReads() const;
+    void setEventTracking(bool enabled);
+    bool getEventTracking() const;
+    void setDelayAccounting(bool enabled);
+    bool getDelayAccounting() const;
+    void setCollectCmdlines(bool enabled);
+    bool getCollectCmdlines() const;
+    void setHistorySpan(float seconds);
+    float getHistorySpan() const;
+    // Call before start(). Replay reads snapshots from the file instead of
+    // running the collectors, paced by the recorded timestamps.
+    bool recordTo(const string& path);
+    bool replayFrom(const string& path, float speed);
+    const string& getSourceStatus() const;
+    bool isReplayFinished() const { return replayDone.load(); } // Every record has been published
+    // Call before start(). Runs on the sampler thread after every publish,
+    // so a waiting UI can wake up for the new snapshot.
+    void setPublishCallback(function<void()> callback);
+};
+
+// Headless mode (--serve): answers HTTP scrapes with the latest snapshot as
+// OpenMetrics text, on a TCP port or a Unix socket. The body is rendered
+// into a reused buffer once per snapshot, so a scrape only copies bytes to
+// the socket. Per-process series are limited to the top N processes by CPU
+// and by resident memory.
+class MetricsExporter {
+private:
+    int listener;
+    string unixPath; // Removed again on close()
+    size_t topProcesses;
+    string body;
+    string request;
+    vector<uint32_t> byCpu, byRss, exported;
+    vector<char> chosen;
+    string status;
+
+    void render(const SystemSnapshot& snapshot);
+    void serveClient(int client);
+
+public:
+    explicit MetricsExporter(size_t topProcesses = 20);
+    ~MetricsExporter();
+    MetricsExporter(const MetricsExporter&) = delete;
+    MetricsExporter& operator=(const MetricsExporter&) = delete;
+    // "PORT" (on 127.0.0.1), ":PORT" (all interfaces), "HOST:PORT" or
+    // "[HOST]:PORT" for TCP; "unix:PATH" or an absolute path for a Unix socket
+    bool listen(const string& address);
+    void close();
+    const string& getStatus() const { return status; }
+    // Serves until SIGINT or SIGTERM
+    void run(SystemSampler& sampler);
+};
+
+enum BatchFormat { BatchJsonLines, BatchCsv };
+
+bool parseBatchFormat(const string& name, BatchFormat& format);
+
+// Batch mode (--batch), like top -b: writes each snapshot to a stream as one
+// JSON object per line, or as CSV with one row per process. Lines are
+// formatted into a reused buffer and written once per snapshot, so after
+// the first few snapshots the output path does not allocate.
+class BatchWriter {
+private:
+    FILE* out;
+    BatchFormat format;
+    size_t topProcesses; // Busiest processes written per snapshot; SIZE_MAX for all of them
+    string buffer;
+    vector<uint32_t> rows;
+    bool headerWritten;
+
+    void appendJson(const SystemSnapshot& snapshot);
+    void appendCsv(const SystemSnapshot& snapshot);
+
+public:
+    BatchWriter(FILE* out, BatchFormat format, size_t topProcesses);
+    bool write(const SystemSnapshot& snapshot); // False once the stream fails
+    // Writes every new snapshot until count have been written (0: no limit),
+    // a replay ends, SIGINT/SIGTERM, or the stream fails
+    bool run(SystemSampler& sampler, unsigned long long count);
+};
+
+// Scan benchmark (--bench-scan): times ProcessScanner over PID lists of
+// each size at each thread count, with plain reads and with io_uring, and
+// prints one line per setting
+bool parsePidCounts(const string& list, vector<size_t>& counts); // "10000,50000"
+bool runScanBenchmark(FILE* out, const vector<size_t>& pidCounts);
+// Parse benchmark (--bench-parse): times parseProcStat against the old
+// istringstream split over the live stat lines and checks they agree on
+// every field. Returns false on a mismatch.
+bool runParseBenchmark(FILE* out);
+
 // System functions
 string CPUinfo();
 const char* getOsName();
 string getCurrentUsername();
 string getHostname();
-map<char, int> countProcessStates();
-int getTotalProcessCount();
 float getCPUTemperature();
 float getFanSpeed();
 string formatNetworkBytes(long long bytes);
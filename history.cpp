@@ -0,0 +1,523 @@
+#include "header.h"
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+void RollupSeries::add(double time, float value) {
+    for (size_t t = 0; t < TierCount; t++) {
+        Tier& tier = tiers[t];
+        long long index = (long long)floor(time / TierSeconds[t]);
+        if (index > tier.newest) {
+            // Open the new bucket, clearing any skipped while nothing was sampled
+            long long first = max(tier.newest + 1, index - (long long)BucketCount + 1);
+            for (long long i = first; i <= index; i++) tier.buckets[i % BucketCount] = RollupBucket{};
+            tier.newest = index;
+        } else if (index <= tier.newest - (long long)BucketCount) {
+            continue; // The clock went back further than this tier remembers
+        }
+
+        RollupBucket& bucket = tier.buckets[index % BucketCount];
+        if (bucket.count == 0) {
+            bucket.min = bucket.max = value;
+        } else {
+            bucket.min = min(bucket.min, value);
+            bucket.max = max(bucket.max, value);
+        }
+        bucket.sum += value;
+        bucket.last = value;
+        bucket.count++;
+    }
+}
+
+void RollupSeries::plot(double span, HistoryPlot& out) const {
+    size_t t = 0;
+    while (t + 1 < TierCount && TierSeconds[t] * BucketCount < span) t++;
+    const Tier& tier = tiers[t];
+    size_t points = min(BucketCount, (size_t)ceil(span / TierSeconds[t]));
+
+    out.values.clear();
+    out.bucketSeconds = (float)TierSeconds[t];
+    out.min = out.max = 0.0f;
+    if (tier.newest < 0) return;
+
+    // Start at the first bucket with data; later gaps repeat the previous value
+    bool any = false;
+    float previous = 0.0f;
+    for (long long i = tier.newest - (long long)points + 1; i <= tier.newest; i++) {
+        if (i < 0) continue;
+        const RollupBucket& bucket = tier.buckets[i % BucketCount];
+        if (bucket.count == 0) {
+            if (any) out.values.push_back(previous);
+            continue;
+        }
+        if (!any) {
+            out.min = bucket.min;
+            out.max = bucket.max;
+            any = true;
+        }
+        out.min = min(out.min, bucket.min);
+        out.max = max(out.max, bucket.max);
+        previous = bucket.sum / bucket.count;
+        out.values.push_back(previous);
+    }
+}
+
+namespace {
+
+// On-disk layout of a segment: this header, then the bit stream
+struct SegmentHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerBytes;
+    int64_t firstTime; // Milliseconds since the epoch of the first sample
+    uint64_t committedBits; // Written last, after the sample it covers
+    char reserved[32];
+};
+static_assert(sizeof(SegmentHeader) == 64, "segment header must stay 64 bytes");
+
+constexpr char SegmentMagic[8] = {'S', 'M', 'H', 'I', 'S', 'T', '1', '\0'};
+constexpr uint64_t SegmentBits = (MetricStore::SegmentBytes - sizeof(SegmentHeader)) * 8;
+constexpr uint64_t MaxSampleBits = 4 + 32 + 2 + 5 + 5 + 32;
+
+bool validSegment(const SegmentHeader* header, uint64_t committed) {
+    return memcmp(header->magic, SegmentMagic, sizeof(SegmentMagic)) == 0 && header->version == 1 &&
+           header->headerBytes == sizeof(SegmentHeader) && committed <= SegmentBits;
+}
+
+// On-disk layout of a rollup file: this header, then the RollupSeries as it
+// is in memory. The magic is written last, so a file whose backfill was cut
+// short is rebuilt.
+struct RollupHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t seriesBytes;
+    char reserved[48];
+};
+static_assert(sizeof(RollupHeader) == 64, "rollup header must stay 64 bytes");
+static_assert(is_trivially_copyable<RollupSeries>::value, "rollups are mapped from disk as they are");
+
+constexpr char RollupMagic[8] = {'S', 'M', 'R', 'O', 'L', 'L', '1', '\0'};
+constexpr size_t RollupFileBytes = sizeof(RollupHeader) + sizeof(RollupSeries);
+
+// Bit I/O, most significant bit first. Segments start zero-filled, so
+// writing only has to OR bits in.
+void writeBits(unsigned char* data, uint64_t& position, uint64_t value, int count) {
+    while (count > 0) {
+        int available = 8 - (int)(position & 7);
+        int take = min(available, count);
+        unsigned chunk = (unsigned)(value >> (count - take)) & ((1u << take) - 1);
+        data[position >> 3] |= (unsigned char)(chunk << (available - take));
+        position += take;
+        count -= take;
+    }
+}
+
+uint64_t readBits(const unsigned char* data, uint64_t& position, int count) {
+    uint64_t value = 0;
+    while (count > 0) {
+        int available = 8 - (int)(position & 7);
+        int take = min(available, count);
+        unsigned chunk = (data[position >> 3] >> (available - take)) & ((1u << take) - 1);
+        value = (value << take) | chunk;
+        position += take;
+        count -= take;
+    }
+    return value;
+}
+
+// Returns false when the timestamp cannot be encoded in this segment
+bool encodeSample(unsigned char* data, uint64_t& position, GorillaState& state, long long time, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    if (state.count == 0) {
+        writeBits(data, position, bits, 32); // Its time is the segment's firstTime
+    } else {
+        long long delta = time - state.time;
+        long long dod = delta - state.delta;
+        if (dod < INT32_MIN || dod > INT32_MAX) return false;
+        if (dod == 0) {
+            writeBits(data, position, 0, 1);
+        } else if (dod >= -63 && dod <= 64) {
+            writeBits(data, position, 0b10, 2);
+            writeBits(data, position, dod + 63, 7);
+        } else if (dod >= -255 && dod <= 256) {
+            writeBits(data, position, 0b110, 3);
+            writeBits(data, position, dod + 255, 9);
+        } else if (dod >= -2047 && dod <= 2048) {
+            writeBits(data, position, 0b1110, 4);
+            writeBits(data, position, dod + 2047, 12);
+        } else {
+            writeBits(data, position, 0b1111, 4);
+            writeBits(data, position, (uint32_t)dod, 32);
+        }
+        state.delta = delta;
+
+        uint32_t x = bits ^ state.value;
+        if (x == 0) {
+            writeBits(data, position, 0, 1);
+        } else {
+            int leading = __builtin_clz(x);
+            int trailing = __builtin_ctz(x);
+            if (leading >= state.leading && trailing >= state.trailing) {
+                // Fits in the previous window
+                writeBits(data, position, 0b10, 2);
+                writeBits(data, position, x >> state.trailing, 32 - state.leading - state.trailing);
+            } else {
+                int length = 32 - leading - trailing;
+                writeBits(data, position, 0b11, 2);
+                writeBits(data, position, leading, 5);
+                writeBits(data, position, length - 1, 5);
+                writeBits(data, position, x >> trailing, length);
+                state.leading = leading;
+                state.trailing = trailing;
+            }
+        }
+    }
+    state.time = time;
+    state.value = bits;
+    state.count++;
+    return true;
+}
+
+void decodeSample(const unsigned char* data, uint64_t& position, GorillaState& state, long long& time, float& value) {
+    if (state.count == 0) {
+        state.value = (uint32_t)readBits(data, position, 32);
+    } else {
+        long long dod;
+        if (readBits(data, position, 1) == 0) dod = 0;
+        else if (readBits(data, position, 1) == 0) dod = (long long)readBits(data, position, 7) - 63;
+        else if (readBits(data, position, 1) == 0) dod = (long long)readBits(data, position, 9) - 255;
+        else if (readBits(data, position, 1) == 0) dod = (long long)readBits(data, position, 12) - 2047;
+        else dod = (int32_t)(uint32_t)readBits(data, position, 32);
+        state.delta += dod;
+        state.time += state.delta;
+
+        if (readBits(data, position, 1) != 0) {
+            if (readBits(data, position, 1) != 0) {
+                state.leading = (int)readBits(data, position, 5);
+                int length = (int)readBits(data, position, 5) + 1;
+                state.trailing = 32 - state.leading - length;
+            }
+            int length = 32 - state.leading - state.trailing;
+            state.value ^= (uint32_t)readBits(data, position, length) << state.trailing;
+        }
+    }
+    state.count++;
+    time = state.time;
+    memcpy(&value, &state.value, sizeof(value));
+}
+
+// Segment files are named <series>.<first time in ms>.seg
+bool parseSegmentName(const string& file, string& series, long long& firstTime) {
+    const string suffix = ".seg";
+    if (file.size() <= suffix.size() || file.compare(file.size() - suffix.size(), suffix.size(), suffix) != 0)
+        return false;
+    string stem = file.substr(0, file.size() - suffix.size());
+    size_t dot = stem.rfind('.');
+    if (dot == string::npos || dot == 0) return false;
+    char* end;
+    firstTime = strtoll(stem.c_str() + dot + 1, &end, 10);
+    if (*end != '\0') return false;
+    series = stem.substr(0, dot);
+    return true;
+}
+
+bool makeDirectories(const string& path) {
+    for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1)) {
+        string prefix = path.substr(0, slash);
+        if (mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) return false;
+        if (slash == string::npos) return true;
+    }
+}
+
+long long toMilliseconds(double time) { return (long long)llround(time * 1000.0); }
+
+}
+
+MetricStore::~MetricStore() { close(); }
+
+bool MetricStore::open(const string& host) {
+    close();
+    const char* dataHome = getenv("XDG_DATA_HOME");
+    const char* home = getenv("HOME");
+    string base;
+    if (dataHome != nullptr && dataHome[0] == '/') base = dataHome;
+    else if (home != nullptr && home[0] == '/') base = string(home) + "/.local/share";
+    else {
+        status = "No HOME or XDG_DATA_HOME for the history store";
+        return false;
+    }
+    string path = base + "/system-monitor/" + (host.empty() ? "localhost" : host);
+    if (!makeDirectories(path)) {
+        status = "Cannot create " + path + ": " + strerror(errno);
+        return false;
+    }
+
+    // Index the existing segments; each series gets its writer entry up front
+    DIR* dir = opendir(path.c_str());
+    if (dir == nullptr) {
+        status = "Cannot read " + path + ": " + strerror(errno);
+        return false;
+    }
+    while (dirent* entry = readdir(dir)) {
+        string series;
+        long long firstTime = 0;
+        if (parseSegmentName(entry->d_name, series, firstTime))
+            writers[series].segments.push_back({path + "/" + entry->d_name, firstTime});
+    }
+    closedir(dir);
+
+    directory = path;
+    long long now = toMilliseconds(chrono::duration<double>(chrono::system_clock::now().time_since_epoch()).count());
+    for (auto& [series, writer] : writers) {
+        sort(writer.segments.begin(), writer.segments.end(),
+             [](const Segment& a, const Segment& b) { return a.firstTime < b.firstTime; });
+        enforceRetention(writer, now);
+    }
+    status = "Recording to " + directory;
+    return true;
+}
+
+void MetricStore::close() {
+    for (auto& [series, writer] : writers) {
+        closeSegment(writer);
+        if (writer.rollups != nullptr) munmap((unsigned char*)writer.rollups - sizeof(RollupHeader), RollupFileBytes);
+        if (writer.rollupFd >= 0) ::close(writer.rollupFd);
+    }
+    writers.clear();
+    directory.clear();
+    status = "Closed";
+}
+
+void MetricStore::closeSegment(SeriesWriter& writer) {
+    if (writer.base != nullptr) munmap(writer.base, SegmentBytes);
+    if (writer.fd >= 0) ::close(writer.fd);
+    writer.base = nullptr;
+    writer.fd = -1;
+}
+
+bool MetricStore::openSegment(const string& series, SeriesWriter& writer, long long time) {
+    closeSegment(writer);
+    // Never reuse a name: another instance, or an earlier run before the clock
+    // went back, may have written it
+    string path;
+    long long name = time;
+    int fd;
+    for (int attempt = 0; ; attempt++, name++) {
+        path = directory + "/" + series + "." + to_string(name) + ".seg";
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd >= 0 || errno != EEXIST || attempt == 15) break;
+    }
+    // The lock keeps other instances from continuing the segment; one that
+    // looks at it before the header is written only holds it briefly
+    if (fd < 0 || flock(fd, LOCK_EX) != 0 || ftruncate(fd, SegmentBytes) != 0) {
+        status = "Cannot write " + path + ": " + strerror(errno);
+        if (fd >= 0) ::close(fd);
+        return false;
+    }
+    void* base = mmap(nullptr, SegmentBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        status = "Cannot map " + path + ": " + strerror(errno);
+        ::close(fd);
+        return false;
+    }
+
+    SegmentHeader* header = (SegmentHeader*)base;
+    memcpy(header->magic, SegmentMagic, sizeof(header->magic));
+    header->version = 1;
+    header->headerBytes = sizeof(SegmentHeader);
+    header->firstTime = time;
+    __atomic_store_n(&header->committedBits, 0, __ATOMIC_RELEASE);
+
+    writer.fd = fd;
+    writer.base = (unsigned char*)base;
+    writer.position = 0;
+    writer.state = GorillaState();
+    writer.segments.push_back({path, name});
+    enforceRetention(writer, time);
+    return true;
+}
+
+bool MetricStore::reopenSegment(SeriesWriter& writer) {
+    if (writer.segments.empty()) return false;
+    const string& path = writer.segments.back().path;
+    int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat info;
+    // A lock already taken means another instance is still writing it
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0 || fstat(fd, &info) != 0 || (size_t)info.st_size != SegmentBytes) {
+        ::close(fd);
+        return false;
+    }
+    void* base = mmap(nullptr, SegmentBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        ::close(fd);
+        return false;
+    }
+
+    // Only a segment with room for another sample is continued. The first
+    // sample's time is implied by the header, so an empty one is not either.
+    SegmentHeader* header = (SegmentHeader*)base;
+    uint64_t committed = __atomic_load_n(&header->committedBits, __ATOMIC_ACQUIRE);
+    unsigned char* data = (unsigned char*)base + sizeof(SegmentHeader);
+    GorillaState state;
+    state.time = header->firstTime;
+    uint64_t position = 0;
+    if (validSegment(header, committed) && committed + MaxSampleBits <= SegmentBits) {
+        // The encoder state is only known by decoding the samples
+        while (position < committed) {
+            long long time;
+            float value;
+            decodeSample(data, position, state, time, value);
+        }
+    }
+    if (state.count == 0 || position != committed) {
+        munmap(base, SegmentBytes);
+        ::close(fd);
+        return false;
+    }
+
+    // Clear what a crash may have left of the sample after the committed one,
+    // since writing only ORs bits in
+    uint64_t end = committed + MaxSampleBits;
+    data[committed >> 3] &= (unsigned char)(0xff00 >> (committed & 7));
+    if ((end + 7) / 8 > committed / 8 + 1) memset(data + committed / 8 + 1, 0, (end + 7) / 8 - committed / 8 - 1);
+
+    writer.fd = fd;
+    writer.base = (unsigned char*)base;
+    writer.position = committed;
+    writer.state = state;
+    return true;
+}
+
+void MetricStore::enforceRetention(SeriesWriter& writer, long long now) {
+    // Never drop the open segment, which is always the newest
+    size_t keepFrom = 0;
+    size_t count = writer.segments.size();
+    while (keepFrom + 1 < count &&
+           (count - keepFrom > MaxSegments ||
+            writer.segments[keepFrom + 1].firstTime < now - (long long)(MaxAgeSeconds * 1000.0))) {
+        unlink(writer.segments[keepFrom].path.c_str());
+        keepFrom++;
+    }
+    writer.segments.erase(writer.segments.begin(), writer.segments.begin() + keepFrom);
+}
+
+void MetricStore::append(const string& series, double time, float value) {
+    if (!isOpen()) return;
+    SeriesWriter& writer = writers[series];
+    long long milliseconds = toMilliseconds(time);
+
+    // The first sample continues the newest segment of an earlier run; a new
+    // segment is started when that one is full or held by another instance,
+    // or when the clock jumped too far to encode
+    if (!writer.resumeChecked) {
+        writer.resumeChecked = true;
+        reopenSegment(writer);
+    }
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (writer.base == nullptr || writer.position + MaxSampleBits > SegmentBits) {
+            if (!openSegment(series, writer, milliseconds)) return;
+        }
+        unsigned char* data = writer.base + sizeof(SegmentHeader);
+        uint64_t position = writer.position;
+        GorillaState state = writer.state;
+        if (encodeSample(data, position, state, milliseconds, value)) {
+            writer.position = position;
+            writer.state = state;
+            __atomic_store_n(&((SegmentHeader*)writer.base)->committedBits, position, __ATOMIC_RELEASE);
+            return;
+        }
+        closeSegment(writer);
+    }
+}
+
+void MetricStore::load(const string& series, double since, const function<void(double, float)>& visit) const {
+    auto it = writers.find(series);
+    if (it == writers.end()) return;
+    const vector<Segment>& segments = it->second.segments;
+    long long sinceMilliseconds = toMilliseconds(since);
+
+    for (size_t i = 0; i < segments.size(); i++) {
+        // A segment ends where the next one starts
+        if (i + 1 < segments.size() && segments[i + 1].firstTime < sinceMilliseconds) continue;
+        if (it->second.base != nullptr && i + 1 == segments.size()) continue; // Being written by us
+
+        int fd = ::open(segments[i].path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue;
+        void* base = mmap(nullptr, SegmentBytes, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (base == MAP_FAILED) continue;
+
+        const SegmentHeader* header = (const SegmentHeader*)base;
+        uint64_t committed = __atomic_load_n(&header->committedBits, __ATOMIC_ACQUIRE);
+        if (validSegment(header, committed)) {
+            const unsigned char* data = (const unsigned char*)base + sizeof(SegmentHeader);
+            GorillaState state;
+            state.time = header->firstTime;
+            uint64_t position = 0;
+            // Samples only start where a whole one fits, which also bounds a corrupt header
+            while (position < committed && position + MaxSampleBits <= SegmentBits) {
+                long long time;
+                float value;
+                decodeSample(data, position, state, time, value);
+                if (time >= sinceMilliseconds) visit(time / 1000.0, value);
+            }
+        }
+        munmap(base, SegmentBytes);
+    }
+}
+
+RollupSeries* MetricStore::mapRollups(const string& series) {
+    if (!isOpen()) return nullptr;
+    SeriesWriter& writer = writers[series];
+    if (writer.rollups != nullptr) return writer.rollups;
+
+    string path = directory + "/" + series + ".rollup";
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        status = "Cannot write " + path + ": " + strerror(errno);
+        return nullptr;
+    }
+    struct stat info;
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        ::close(fd); // Another instance keeps these rollups up to date
+        return nullptr;
+    }
+    // A file of another size is from another build; start it over
+    if (fstat(fd, &info) != 0 || ((size_t)info.st_size != RollupFileBytes &&
+                                  (ftruncate(fd, 0) != 0 || ftruncate(fd, RollupFileBytes) != 0))) {
+        status = "Cannot write " + path + ": " + strerror(errno);
+        ::close(fd);
+        return nullptr;
+    }
+    void* base = mmap(nullptr, RollupFileBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        status = "Cannot map " + path + ": " + strerror(errno);
+        ::close(fd);
+        return nullptr;
+    }
+
+    RollupHeader* header = (RollupHeader*)base;
+    RollupSeries* rollups = (RollupSeries*)((unsigned char*)base + sizeof(RollupHeader));
+    if (memcmp(header->magic, RollupMagic, sizeof(RollupMagic)) != 0 || header->version != 1 ||
+        header->seriesBytes != sizeof(RollupSeries)) {
+        // First run with rollup files: build them once from the segments
+        memset(base, 0, RollupFileBytes);
+        new (rollups) RollupSeries();
+        double now = chrono::duration<double>(chrono::system_clock::now().time_since_epoch()).count();
+        double since = now - RollupSeries::TierSeconds[RollupSeries::TierCount - 1] * RollupSeries::BucketCount;
+        load(series, since, [rollups](double time, float value) { rollups->add(time, value); });
+        header->version = 1;
+        header->seriesBytes = sizeof(RollupSeries);
+        memcpy(header->magic, RollupMagic, sizeof(header->magic));
+    }
+    writer.rollupFd = fd;
+    writer.rollups = rollups;
+    return rollups;
+}
@@ -1,48 +1,59 @@
 #include "header.h"
+#ifndef MONITOR_HEADLESS
 #include <SDL2/SDL.h>
 #include <GL/gl3w.h>
+#endif
 #include <vector>
 #include <algorithm>
 #include <set>
 #include <chrono>
-// Global performance trackers
-struct NetworkRate {
-    map<string, pair<long long, float>> lastRX, lastTX; // Last bytes, timestamp
-    map<string, float> rxRate, txRate; // Rates in bytes/sec
-    void update(NetworkTracker& tracker, float time) {
-        auto rxStats = tracker.getNetworkRX();
-        auto txStats = tracker.getNetworkTX();
-        for (auto& [iface, rx] : rxStats) {
-            if (lastRX.count(iface)) {
-                float dt = time - lastRX[iface].second;
-                rxRate[iface] = dt > 0 ? (rx.bytes - lastRX[iface].first) / dt : 0;
-            }
-            lastRX[iface] = {rx.bytes, time};
-        }
-        for (auto& [iface, tx] : txStats) {
-            if (lastTX.count(iface)) {
-                float dt = time - lastTX[iface].second;
-                txRate[iface] = dt > 0 ? (tx.bytes - lastTX[iface].first) / dt : 0;
-            }
-            lastTX[iface] = {tx.bytes, time};
-        }
-    }
-};
+#include <cstring>
+// Background collector feeding every window
+static SystemSampler sampler;
 
-static CPUUsageTracker cpuTracker;
-static ProcessUsageTracker processTracker;
-static vector<float> cpuUsageHistory(100, 0.0f);
-static vector<float> temperatureHistory(100, 0.0f);
-static NetworkRate rateTracker;
-static vector<float> cpuUsageBuffer(5, 0.0f);  // Buffer for last 5 readings
-static int bufferIndex = 0;
+#ifndef MONITOR_HEADLESS
+static RingSeries<float, 100> cpuUsageHistory(0.0f);
+static RingSeries<float, 100> temperatureHistory(0.0f);
+static RingSeries<float, 5> cpuUsageBuffer(0.0f);  // Buffer for last 5 readings
 
 // Timing variables for graph updates
 static float cpuUpdateTime = 0.0f;
 static float fanUpdateTime = 0.0f;
 static float thermalUpdateTime = 0.0f;
 
-void systemWindow(const char* id, ImVec2 size, ImVec2 position) {
+// Frames are only drawn on demand, so a live graph pushes every point it
+// missed since the last frame, up to one full graph
+template<typename T, size_t N>
+void pushElapsed(RingSeries<T, N>& history, float& elapsed, float interval, const T& value) {
+    for (size_t points = 0; elapsed >= interval && points < N; points++) {
+        history.push(value);
+        elapsed -= interval;
+    }
+    if (elapsed >= interval) elapsed = 0.0f;
+}
+
+// Spans offered for the history graphs; "Live" keeps the per-frame graph
+static const float historySpans[] = {0.0f, 600.0f, 3600.0f, 6 * 3600.0f, 24 * 3600.0f, 4 * 24 * 3600.0f};
+static const char* historySpanNames[] = {"Live", "10 minutes", "1 hour", "6 hours", "24 hours", "4 days"};
+static int historySpanIndex = 0;
+
+// Span picker shared by every history graph. Returns true when a rollup
+// span is selected instead of the live graph.
+bool historySpanCombo(const SystemSnapshot& snapshot) {
+    if (ImGui::Combo("History", &historySpanIndex, historySpanNames, IM_ARRAYSIZE(historySpanNames)) &&
+        historySpanIndex > 0)
+        sampler.setHistorySpan(historySpans[historySpanIndex]);
+    if (ImGui::IsItemHovered()) ImGui::SetTooltip("%s", snapshot.historyStatus.c_str());
+    return historySpanIndex > 0;
+}
+
+void historyPlot(const char* label, const HistoryPlot& plot, const string& overlay, float scaleMax) {
+    ImGui::PlotLines(label, plot.values.data(), (int)plot.values.size(), 0, overlay.c_str(), 0.0f, scaleMax,
+                     ImVec2(0, 80));
+    ImGui::Text("%zu points of %.0f s", plot.values.size(), plot.bucketSeconds);
+}
+
+void systemWindow(const char* id, ImVec2 size, ImVec2 position, const SystemSnapshot& snapshot) {
     ImGuiIO& io = ImGui::GetIO();
     ImGui::Begin(id);
     ImGui::SetWindowSize(size);
@@ -50,19 +61,12 @@ void systemWindow(const char* id, ImVec2 size, ImVec2 position) {
 
     ImGui::BeginChild("SystemInfo", ImVec2(0, 150), true);
     ImGui::Text("Operating System: %s", getOsName());
-    ImGui::Text("Username: %s", getCurrentUsername().c_str());
-    ImGui::Text("Hostname: %s", getHostname().c_str());
-    ImGui::Text("Total Processes: %d", getTotalProcessCount());
-    ImGui::Text("CPU Type: %s", CPUinfo().c_str());
-    static auto lastUpdateTime = std::chrono::steady_clock::now();
-    static std::map<char, int> cachedStates;
-    
-    auto now = std::chrono::steady_clock::now();
-    if (std::chrono::duration_cast<std::chrono::seconds>(now - lastUpdateTime).count() >= 1) {
-        cachedStates = countProcessStates();
-        lastUpdateTime = now;
-    }
-    
+    ImGui::Text("Username: %s", snapshot.username.c_str());
+    ImGui::Text("Hostname: %s", snapshot.hostname.c_str());
+    ImGui::Text("Total Processes: %d", snapshot.processes->total);
+    ImGui::Text("CPU Type: %s", snapshot.cpuInfo.c_str());
+    const array<int, 128>& processStates = snapshot.processes->states;
+
     ImGui::Text("Process States:");
     // Define known states with their labels
     const vector<pair<char, string>> stateLabels = {
@@ -74,21 +78,19 @@ void systemWindow(const char* id, ImVec2 size, ImVec2 position) {
         {'I', "Idle"}
     };
     
-    int totalProcesses = 0;
-    for (const auto& [state, count] : cachedStates) {
-        totalProcesses += count;
-    }
-    ImGui::Text("  Total Processes: %d", totalProcesses);
+    ImGui::Text("  Total Processes: %d", snapshot.processes->total);
 
     // Display known states first
     for (const auto& [code, label] : stateLabels) {
-        if (cachedStates.count(code)) {
-            ImGui::Text("  %s: %d", label.c_str(), cachedStates.at(code));
+        if (processStates[code] > 0) {
+            ImGui::Text("  %s: %d", label.c_str(), processStates[code]);
         }
     }
     
     // Display any unknown states
-    for (const auto& [state, count] : cachedStates) {
+    for (int state = 0; state < (int)processStates.size(); state++) {
+        int count = processStates[state];
+        if (count == 0) continue;
         bool isKnown = any_of(stateLabels.begin(), stateLabels.end(),
                             [state](const auto& pair) { return pair.first == state; });
         if (!isKnown) {
@@ -102,35 +104,35 @@ void systemWindow(const char* id, ImVec2 size, ImVec2 position) {
         static bool pauseGraph = false;
         static float graphFPS = 30.0f;
         static float graphYScale = 100.0f;
-        float currentCPUUsage = cpuTracker.calculateCPUUsage();
-
-        // Add moving average calculation
-        cpuUsageBuffer[bufferIndex] = currentCPUUsage;
-        bufferIndex = (bufferIndex + 1) % cpuUsageBuffer.size();
+        static unsigned long long lastSequence = 0;
 
-        float smoothedCPUUsage = 0.0f;
-        for (float usage : cpuUsageBuffer) {
-            smoothedCPUUsage += usage;
+        // Add moving average calculation, one reading per collected sample
+        if (snapshot.collected[CollectorCpu] != lastSequence) {
+            cpuUsageBuffer.push(snapshot.cpuUsage);
+            lastSequence = snapshot.collected[CollectorCpu];
         }
-        smoothedCPUUsage /= cpuUsageBuffer.size();
+
+        float smoothedCPUUsage = cpuUsageBuffer.mean();
 
         if (!pauseGraph) {
-            float updateInterval = 1.0f / graphFPS;
             cpuUpdateTime += io.DeltaTime;
-            if (cpuUpdateTime >= updateInterval) {
-                cpuUsageHistory.erase(cpuUsageHistory.begin());
-                cpuUsageHistory.push_back(smoothedCPUUsage);  // Use smoothed value
-                cpuUpdateTime = 0.0f;
-            }
+            pushElapsed(cpuUsageHistory, cpuUpdateTime, 1.0f / graphFPS, smoothedCPUUsage);  // Use smoothed value
         }
 
         ImGui::Checkbox("Pause Graph", &pauseGraph);
         ImGui::SliderFloat("Graph FPS", &graphFPS, 1.0f, 60.0f);
         ImGui::SliderFloat("Y-Scale", &graphYScale, 10.0f, 200.0f);
 
-        ImGui::PlotLines("CPU Usage", cpuUsageHistory.data(), cpuUsageHistory.size(),
-                        0, TextF("CPU: %.1f%%", smoothedCPUUsage).c_str(),  // Use smoothed value
-                        0.0f, graphYScale, ImVec2(0, 80));
+        if (historySpanCombo(snapshot)) {
+            const HistoryPlot& plot = snapshot.history[HistoryCpu];
+            historyPlot("CPU Usage", plot, TextF("CPU: %.1f%% - %.1f%%", plot.min, plot.max), graphYScale);
+        } else {
+            ImGui::PlotLines("CPU Usage", cpuUsageHistory.data(), (int)cpuUsageHistory.size(),
+                            (int)cpuUsageHistory.offset(), TextF("CPU: %.1f%%", smoothedCPUUsage).c_str(),  // Use smoothed value
+                            0.0f, graphYScale, ImVec2(0, 80));
+            ImGui::Text("Min %.1f%%  Avg %.1f%%  Max %.1f%%", cpuUsageHistory.min(), cpuUsageHistory.mean(),
+                        cpuUsageHistory.max());
+        }
         ImGui::EndTabItem();
     }
 
@@ -138,18 +140,13 @@ void systemWindow(const char* id, ImVec2 size, ImVec2 position) {
             static bool pauseGraph = false;
             static float graphFPS = 30.0f;
             static float graphYScale = 5000.0f;
-            static vector<float> fanSpeedHistory(100, 0.0f);
-            float fanSpeed = getFanSpeed();
+            static RingSeries<float, 100> fanSpeedHistory(0.0f);
+            float fanSpeed = snapshot.fanSpeed;
             bool fanAvailable = fanSpeed > 0;
 
             if (!pauseGraph) {
-                float updateInterval = 1.0f / graphFPS;
                 fanUpdateTime += io.DeltaTime;
-                if (fanUpdateTime >= updateInterval) {
-                    fanSpeedHistory.erase(fanSpeedHistory.begin());
-                    fanSpeedHistory.push_back(fanSpeed);
-                    fanUpdateTime = 0.0f;
-                }
+                pushElapsed(fanSpeedHistory, fanUpdateTime, 1.0f / graphFPS, fanSpeed);
             }
 
             ImGui::Checkbox("Pause Graph", &pauseGraph);
@@ -162,9 +159,14 @@ void systemWindow(const char* id, ImVec2 size, ImVec2 position) {
                 ImGui::Text("Fan Level: %s",
                             fanSpeed < 1000 ? "Low" : fanSpeed < 3000 ? "Medium" : "High");
 
-                ImGui::PlotLines("Fan Speed", fanSpeedHistory.data(), fanSpeedHistory.size(),
-                                0, TextF("%.0f RPM", fanSpeed).c_str(),
-                                0.0f, graphYScale, ImVec2(0, 80));
+                if (historySpanCombo(snapshot)) {
+                    const HistoryPlot& plot = snapshot.history[HistoryFan];
+                    historyPlot("Fan Speed", plot, TextF("%.0f - %.0f RPM", plot.min, plot.max), graphYScale);
+                } else {
+                    ImGui::PlotLines("Fan Speed", fanSpeedHistory.data(), (int)fanSpeedHistory.size(),
+                                    (int)fanSpeedHistory.offset(), TextF("%.0f RPM", fanSpeed).c_str(),
+                                    0.0f, graphYScale, ImVec2(0, 80));
+                }
             } else {
                 ImGui::TextColored(ImVec4(1.0f, 0.5f, 0.0f, 1.0f), "Fan information not available on this system");
                 ImGui::Text("Fan monitoring is supported on some ThinkPad models and");
@@ -177,17 +179,12 @@ void systemWindow(const char* id, ImVec2 size, ImVec2 position) {
             static bool pauseGraph = false;
             static float graphFPS = 30.0f;
             static float graphYScale = 100.0f;
-            float temperature = getCPUTemperature();
+            float temperature = snapshot.temperature;
             bool tempAvailable = temperature > 0.1f; // Small threshold to detect valid readings
 
             if (!pauseGraph) {
-                float updateInterval = 1.0f / graphFPS;
                 thermalUpdateTime += io.DeltaTime;
-                if (thermalUpdateTime >= updateInterval) {
-                    temperatureHistory.erase(temperatureHistory.begin());
-                    temperatureHistory.push_back(temperature);
-                    thermalUpdateTime = 0.0f;
-                }
+                pushElapsed(temperatureHistory, thermalUpdateTime, 1.0f / graphFPS, temperature);
             }
 
             ImGui::Checkbox("Pause Graph", &pauseGraph);
@@ -196,9 +193,14 @@ void systemWindow(const char* id, ImVec2 size, ImVec2 position) {
 
             if (tempAvailable) {
                 ImGui::Text("Current Temperature: %.1f°C", temperature);
-                ImGui::PlotLines("Temperature", temperatureHistory.data(), temperatureHistory.size(),
-                                0, TextF("Temp: %.1f°C", temperature).c_str(),
-                                0.0f, graphYScale, ImVec2(0, 80));
+                if (historySpanCombo(snapshot)) {
+                    const HistoryPlot& plot = snapshot.history[HistoryTemperature];
+                    historyPlot("Temperature", plot, TextF("Temp: %.1f - %.1f°C", plot.min, plot.max), graphYScale);
+                } else {
+                    ImGui::PlotLines("Temperature", temperatureHistory.data(), (int)temperatureHistory.size(),
+                                    (int)temperatureHistory.offset(), TextF("Temp: %.1f°C", temperature).c_str(),
+                                    0.0f, graphYScale, ImVec2(0, 80));
+                }
 
                 // Add temperature status indicator
                 if (temperature < 50.0f) {
@@ -217,23 +219,39 @@ void systemWindow(const char* id, ImVec2 size, ImVec2 position) {
             }
             ImGui::EndTabItem();
         }
+
+        if (ImGui::BeginTabItem("Collectors")) {
+            // Period and phase of each collector; changes apply from the next tick
+            ImGui::Text("Period and phase in seconds; a collector runs at phase + n * period");
+            for (int c = 0; c < CollectorCount; c++) {
+                Collector collector = (Collector)c;
+                ImGui::PushID(c);
+                float period = sampler.getPeriod(collector);
+                ImGui::SetNextItemWidth(200.0f);
+                if (ImGui::SliderFloat("##period", &period, 0.05f, 10.0f, "%.2f s", ImGuiSliderFlags_Logarithmic))
+                    sampler.setPeriod(collector, period);
+                ImGui::SameLine();
+                float phase = sampler.getPhase(collector);
+                ImGui::SetNextItemWidth(120.0f);
+                if (ImGui::SliderFloat("##phase", &phase, 0.0f, period, "%.2f s")) sampler.setPhase(collector, phase);
+                ImGui::SameLine();
+                ImGui::Text("%s", CollectorScheduler::Names[c]);
+                ImGui::PopID();
+            }
+            ImGui::EndTabItem();
+        }
         ImGui::EndTabBar();
     }
     ImGui::End();
 }
 
-void memoryProcessesWindow(const char* id, ImVec2 size, ImVec2 position) {
-    ImGuiIO& io = ImGui::GetIO();
-    processTracker.updateDeltaTime(io.DeltaTime);
-    float currentTime = ImGui::GetTime(); // Get current time for throttling
-
+void memoryProcessesWindow(const char* id, ImVec2 size, ImVec2 position, const SystemSnapshot& snapshot) {
     ImGui::Begin(id);
     ImGui::SetWindowSize(size);
     ImGui::SetWindowPos(position);
 
-    SystemResourceTracker resourceTracker;
-    MemoryInfo memInfo = resourceTracker.getMemoryInfo();
-    DiskInfo diskInfo = resourceTracker.getDiskInfo();
+    const MemoryInfo& memInfo = snapshot.memInfo;
+    const DiskInfo& diskInfo = snapshot.diskInfo;
 
     ImGui::BeginChild("Memory Info", ImVec2(0, 150), true);
     ImGui::Text("RAM Usage: %ld MB / %ld MB (%.2f%%)",
@@ -253,51 +271,166 @@ void memoryProcessesWindow(const char* id, ImVec2 size, ImVec2 position) {
     ImGui::EndChild();
 
     static char processFilter[256] = "";
+    static bool filterRegex = false;
     ImGui::InputText("Filter Processes", processFilter, sizeof(processFilter));
+    ImGui::SameLine();
+    ImGui::Checkbox("Regex", &filterRegex);
+    ImGui::SameLine();
+    bool matchCmdline = sampler.getCollectCmdlines();
+    if (ImGui::Checkbox("Command Line", &matchCmdline)) sampler.setCollectCmdlines(matchCmdline);
+
+    int scanThreads = sampler.getScanThreads();
+    if (ImGui::SliderInt("Scan Threads", &scanThreads, 1, 16)) sampler.setScanThreads(scanThreads);
+    ImGui::SameLine();
+    ImGui::Text("%.1f ms / %d threads", snapshot.processes->scanMilliseconds, snapshot.processes->scanThreads);
+
+    // Reading a held stat file costs less than opening it again
+    bool keepStatFds = sampler.getStatFdBudget() > 0;
+    if (ImGui::Checkbox("Keep Stat Files Open", &keepStatFds))
+        sampler.setStatFdBudget(keepStatFds ? ProcessScanner::statFdLimit() : 0);
+    ImGui::SameLine();
+    if (keepStatFds) ImGui::Text("%d of %d descriptors", snapshot.processes->statFds, snapshot.processes->statFdBudget);
+    else ImGui::Text("Opening /proc/<pid>/stat every scan");
+
+    bool batchReads = sampler.getBatchReads();
+    if (ImGui::Checkbox("Batch Reads (io_uring)", &batchReads)) sampler.setBatchReads(batchReads);
+    ImGui::SameLine();
+    if (!batchReads || snapshot.processes->batchedReads) ImGui::Text("%s", snapshot.processes->readStatus.c_str());
+    else ImGui::TextColored(ImVec4(1.0f, 0.5f, 0.0f, 1.0f), "%s", snapshot.processes->readStatus.c_str());
+
+    bool eventTracking = sampler.getEventTracking();
+    if (ImGui::Checkbox("Track Process Events", &eventTracking)) sampler.setEventTracking(eventTracking);
+    ImGui::SameLine();
+    if (!eventTracking) {
+        ImGui::Text("Polling /proc");
+    } else if (snapshot.processes->eventDriven) {
+        ImGui::Text("Netlink: %llu forks, %llu exits", snapshot.processes->forkCount, snapshot.processes->exitCount);
+    } else {
+        ImGui::TextColored(ImVec4(1.0f, 0.5f, 0.0f, 1.0f), "Proc connector unavailable, polling /proc");
+    }
+
+    bool delayAccounting = sampler.getDelayAccounting();
+    if (ImGui::Checkbox("Delay Accounting", &delayAccounting)) sampler.setDelayAccounting(delayAccounting);
+    ImGui::SameLine();
+    if (snapshot.processes->hasDelays) ImGui::Text("%s", snapshot.processes->delayStatus.c_str());
+    else ImGui::TextColored(ImVec4(1.0f, 0.5f, 0.0f, 1.0f), "%s", snapshot.processes->delayStatus.c_str());
+
+    const vector<ShortLivedProcess>& shortLived = snapshot.processes->shortLived;
+    if (!shortLived.empty() && ImGui::TreeNode("ShortLived", "Short-lived Processes (%zu)", shortLived.size())) {
+        if (ImGui::BeginTable("Short-lived", 5, ImGuiTableFlags_Resizable | ImGuiTableFlags_ScrollY, ImVec2(0, 120))) {
+            ImGui::TableSetupColumn("PID");
+            ImGui::TableSetupColumn("Parent");
+            ImGui::TableSetupColumn("Name");
+            ImGui::TableSetupColumn("Lifetime");
+            ImGui::TableSetupColumn("Exit Code");
+            ImGui::TableHeadersRow();
+            for (const auto& proc : shortLived) {
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn(); ImGui::Text("%d", proc.pid);
+                ImGui::TableNextColumn(); ImGui::Text("%d", proc.ppid);
+                ImGui::TableNextColumn(); ImGui::Text("%s", proc.name.c_str());
+                ImGui::TableNextColumn(); ImGui::Text("%.1f ms", proc.lifetimeMs);
+                ImGui::TableNextColumn(); ImGui::Text("%d", proc.exitCode);
+            }
+            ImGui::EndTable();
+        }
+        ImGui::TreePop();
+    }
 
-    vector<Proc> processes = resourceTracker.getProcessList();
+    const ProcessTable& processes = *snapshot.processes;
 
     // Track selected processes
     static set<int> selectedPids;
 
-    if (ImGui::BeginTable("Processes", 5,
-                          ImGuiTableFlags_Resizable | ImGuiTableFlags_Reorderable | ImGuiTableFlags_Sortable)) {
-        ImGui::TableSetupColumn("PID");
-        ImGui::TableSetupColumn("Name");
-        ImGui::TableSetupColumn("State");
-        ImGui::TableSetupColumn("CPU Usage");
-        ImGui::TableSetupColumn("Memory Usage");
+    // Display order survives across snapshots so re-sorting stays cheap
+    static ProcessView processView;
+
+    processView.setFilter(processFilter, filterRegex, matchCmdline);
+    if (!processView.getFilterError().empty()) {
+        ImGui::TextColored(ImVec4(1.0f, 0.5f, 0.0f, 1.0f), "Invalid regex: %s", processView.getFilterError().c_str());
+    }
+
+    // Scrolls inside its own child so only the visible rows get submitted;
+    // leaves one line below for the selection count
+    bool showDelays = snapshot.processes->hasDelays;
+    if (ImGui::BeginTable("Processes", showDelays ? 9 : 5,
+                          ImGuiTableFlags_Resizable | ImGuiTableFlags_Reorderable | ImGuiTableFlags_Sortable |
+                              ImGuiTableFlags_SortMulti | ImGuiTableFlags_ScrollY,
+                          ImVec2(0, -ImGui::GetTextLineHeightWithSpacing()))) {
+        ImGui::TableSetupScrollFreeze(0, 1);
+        ImGui::TableSetupColumn("PID", ImGuiTableColumnFlags_DefaultSort, -1.0f, ColumnPid);
+        ImGui::TableSetupColumn("Name", 0, -1.0f, ColumnName);
+        ImGui::TableSetupColumn("State", 0, -1.0f, ColumnState);
+        ImGui::TableSetupColumn("CPU Usage", ImGuiTableColumnFlags_PreferSortDescending, -1.0f, ColumnCpu);
+        ImGui::TableSetupColumn("Memory Usage", ImGuiTableColumnFlags_PreferSortDescending, -1.0f, ColumnMemory);
+        if (showDelays) {
+            ImGui::TableSetupColumn("CPU Delay", ImGuiTableColumnFlags_PreferSortDescending, -1.0f, ColumnCpuDelay);
+            ImGui::TableSetupColumn("IO Delay", ImGuiTableColumnFlags_PreferSortDescending, -1.0f, ColumnIoDelay);
+            ImGui::TableSetupColumn("Swap Delay", ImGuiTableColumnFlags_PreferSortDescending, -1.0f, ColumnSwapDelay);
+            ImGui::TableSetupColumn("Reclaim Delay", ImGuiTableColumnFlags_PreferSortDescending, -1.0f,
+                                    ColumnReclaimDelay);
+        }
         ImGui::TableHeadersRow();
 
-        for (const auto& proc : processes) {
-            if (processFilter[0] != '\0' && strstr(proc.name.c_str(), processFilter) == nullptr)
-                continue;
-
-            ImGui::TableNextRow();
-            ImGui::TableNextColumn();
-            bool isSelected = selectedPids.count(proc.pid) > 0;
-            // Use Selectable for the entire row, starting with PID
-            if (ImGui::Selectable(TextF("%d", proc.pid).c_str(), isSelected, ImGuiSelectableFlags_SpanAllColumns)) {
-                if (ImGui::GetIO().KeyCtrl) {
-                    // Multi-select with Ctrl
-                    if (isSelected) selectedPids.erase(proc.pid); // Deselect
-                    else selectedPids.insert(proc.pid); // Select
-                } else {
-                    // Single-select without Ctrl
-                    selectedPids.clear();
-                    selectedPids.insert(proc.pid);
-                }
+        ImGuiTableSortSpecs* sortSpecs = ImGui::TableGetSortSpecs();
+        if (sortSpecs != nullptr && sortSpecs->SpecsDirty) {
+            vector<ProcessSortKey> keys;
+            for (int i = 0; i < sortSpecs->SpecsCount; i++) {
+                const ImGuiTableColumnSortSpecs& spec = sortSpecs->Specs[i];
+                keys.push_back({(ProcessColumn)spec.ColumnUserID,
+                                spec.SortDirection == ImGuiSortDirection_Descending});
             }
+            processView.setSort(keys);
+            sortSpecs->SpecsDirty = false;
+        }
+        processView.update(processes, snapshot.collected[CollectorProcesses]);
+
+        const vector<uint32_t>& rows = processView.getRows();
+        ImGuiListClipper clipper;
+        clipper.Begin((int)rows.size());
+        while (clipper.Step()) {
+            for (int line = clipper.DisplayStart; line < clipper.DisplayEnd; line++) {
+                uint32_t row = rows[line];
+                const char* name = processes.nameOf(row);
+                int pid = processes.pid[row];
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                bool isSelected = selectedPids.count(pid) > 0;
+                // Use Selectable for the entire row, starting with PID
+                if (ImGui::Selectable(TextF("%d", pid).c_str(), isSelected, ImGuiSelectableFlags_SpanAllColumns)) {
+                    if (ImGui::GetIO().KeyCtrl) {
+                        // Multi-select with Ctrl
+                        if (isSelected) selectedPids.erase(pid); // Deselect
+                        else selectedPids.insert(pid); // Select
+                    } else {
+                        // Single-select without Ctrl
+                        selectedPids.clear();
+                        selectedPids.insert(pid);
+                    }
+                }
 
-            // Display remaining columns
-            ImGui::TableNextColumn(); ImGui::Text("%s", proc.name.c_str());
-            ImGui::TableNextColumn(); ImGui::Text("%c", proc.state);
-            ImGui::TableNextColumn();
-            float cpuUsage = processTracker.calculateProcessCPUUsage(proc, currentTime);
-            ImGui::Text("%.2f%%", cpuUsage);
-            ImGui::TableNextColumn();
-            float memPercent = (proc.vsize / 1024.0f) / memInfo.total_ram * 100.0f;
-            ImGui::Text("%.2f%%", memPercent);
+                // Display remaining columns
+                ImGui::TableNextColumn(); ImGui::Text("%s", name);
+                if (processes.hasCmdlines && processes.cmdlineLength(row) > 0 && ImGui::IsItemHovered())
+                    ImGui::SetTooltip("%s", processes.cmdlineOf(row));
+                ImGui::TableNextColumn(); ImGui::Text("%c", processes.state[row]);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.2f%%", processes.cpu[row]);
+                ImGui::TableNextColumn();
+                float memPercent = (processes.vsize[row] / 1024.0f) / memInfo.total_ram * 100.0f;
+                ImGui::Text("%.2f%%", memPercent);
+                if (showDelays) {
+                    // Totals since the process started, in milliseconds; "-"
+                    // where taskstats gave no answer
+                    for (const vector<unsigned long long>* column :
+                         {&processes.cpuDelay, &processes.blkioDelay, &processes.swapinDelay, &processes.reclaimDelay}) {
+                        ImGui::TableNextColumn();
+                        unsigned long long delay = (*column)[row];
+                        if (delay == NoDelay) ImGui::TextDisabled("-");
+                        else ImGui::Text("%.1f ms", delay / 1e6);
+                    }
+                }
+            }
         }
         ImGui::EndTable();
     }
@@ -308,13 +441,12 @@ void memoryProcessesWindow(const char* id, ImVec2 size, ImVec2 position) {
     ImGui::End();
 }
 
-void networkWindow(const char* id, ImVec2 size, ImVec2 position) {
+void networkWindow(const char* id, ImVec2 size, ImVec2 position, const SystemSnapshot& snapshot) {
     ImGui::Begin(id);
     ImGui::SetWindowSize(size);
     ImGui::SetWindowPos(position);
 
-    NetworkTracker networkTracker;
-    Networks interfaces = networkTracker.getNetworkInterfaces();
+    const Networks& interfaces = snapshot.interfaces;
     ImGui::Text("Network Interfaces:");
     for (const auto& iface : interfaces.ip4s) {
         ImGui::Text("%s: %s", iface.name, iface.addressBuffer);
@@ -322,7 +454,7 @@ void networkWindow(const char* id, ImVec2 size, ImVec2 position) {
 
     if (ImGui::BeginTabBar("NetworkTabs")) {
         if (ImGui::BeginTabItem("RX (Receiver)")) {
-            map<string, RX> rxStats = networkTracker.getNetworkRX();
+            const map<string, RX>& rxStats = snapshot.rx;
             if (ImGui::BeginTable("RX Stats", 8, ImGuiTableFlags_Resizable | ImGuiTableFlags_Reorderable)) {
                 ImGui::TableSetupColumn("Interface");
                 ImGui::TableSetupColumn("Bytes");
@@ -351,7 +483,7 @@ void networkWindow(const char* id, ImVec2 size, ImVec2 position) {
         }
 
         if (ImGui::BeginTabItem("TX (Transmitter)")) {
-            map<string, TX> txStats = networkTracker.getNetworkTX();
+            const map<string, TX>& txStats = snapshot.tx;
             if (ImGui::BeginTable("TX Stats", 8, ImGuiTableFlags_Resizable | ImGuiTableFlags_Reorderable)) {
                 ImGui::TableSetupColumn("Interface");
                 ImGui::TableSetupColumn("Bytes");
@@ -385,15 +517,15 @@ void networkWindow(const char* id, ImVec2 size, ImVec2 position) {
             ImGui::SameLine();
             ImGui::Checkbox("Show TX", &showTX);
 
-            map<string, RX> rxStats = networkTracker.getNetworkRX();
-            map<string, TX> txStats = networkTracker.getNetworkTX();
-            rateTracker.update(networkTracker, ImGui::GetTime()); // Update rates
+            const map<string, RX>& rxStats = snapshot.rx;
+            const map<string, TX>& txStats = snapshot.tx;
 
             if (showRX) {
                 ImGui::Text("RX Network Usage:");
                 for (const auto& [iface, rx] : rxStats) {
                     if (iface.find("lo") != string::npos) continue;
-                    float rate = rateTracker.rxRate[iface]; // Bytes per second
+                    auto rateIt = snapshot.rxRate.find(iface);
+                    float rate = rateIt != snapshot.rxRate.end() ? rateIt->second : 0.0f; // Bytes per second
                     float scaledRate = rate / (1024 * 1024); // Scale to MB/s for progress bar
                     ImGui::Text("%s:", iface.c_str());
                     ImGui::SameLine(150);
@@ -405,21 +537,124 @@ void networkWindow(const char* id, ImVec2 size, ImVec2 position) {
                 ImGui::Text("TX Network Usage:");
                 for (const auto& [iface, tx] : txStats) {
                     if (iface.find("lo") != string::npos) continue;
-                    float rate = rateTracker.txRate[iface]; // Bytes per second
+                    auto rateIt = snapshot.txRate.find(iface);
+                    float rate = rateIt != snapshot.txRate.end() ? rateIt->second : 0.0f; // Bytes per second
                     float scaledRate = rate / (1024 * 1024); // Scale to MB/s for progress bar
                     ImGui::Text("%s:", iface.c_str());
                     ImGui::SameLine(150);
                     ImGui::ProgressBar(scaledRate, ImVec2(-1, 0), formatNetworkBytes(rate).c_str());
                 }
             }
+
+            // Totals over every interface, in bytes per second; scaled to fit
+            if (historySpanCombo(snapshot)) {
+                const HistoryPlot& rxPlot = snapshot.history[HistoryRx];
+                const HistoryPlot& txPlot = snapshot.history[HistoryTx];
+                if (showRX)
+                    historyPlot("RX Total", rxPlot, "Peak " + formatNetworkBytes(rxPlot.max) + "/s", FLT_MAX);
+                if (showTX)
+                    historyPlot("TX Total", txPlot, "Peak " + formatNetworkBytes(txPlot.max) + "/s", FLT_MAX);
+            }
             ImGui::EndTabItem();
         }
         ImGui::EndTabBar();
     }
     ImGui::End();
 }
+#endif
+
+int main(int argc, char** argv) {
+    // --record <file> saves every snapshot; --replay <file> [--speed N] shows
+    // a recording instead of this machine; --serve <address> and --batch run
+    // without a window and export metrics instead; --bench-scan times the
+    // process scanner and --bench-parse the stat parser, then exit
+    const char* recordPath = nullptr;
+    const char* replayPath = nullptr;
+    const char* serveAddress = nullptr;
+    bool batch = false;
+    BatchFormat batchFormat = BatchJsonLines;
+    unsigned long long batchCount = 0;
+    float replaySpeed = 1.0f;
+    long topProcesses = -1; // Unset: 20 for --serve, every process for --batch
+    vector<size_t> benchPids;
+    bool benchParse = false;
+    bool intervalSet = false;
+    for (int i = 1; i < argc; i++) {
+        string option = argv[i];
+        if (i + 1 < argc && option == "--record") recordPath = argv[++i];
+        else if (i + 1 < argc && option == "--replay") replayPath = argv[++i];
+        else if (i + 1 < argc && option == "--speed") replaySpeed = strtof(argv[++i], nullptr);
+        else if (i + 1 < argc && option == "--serve") serveAddress = argv[++i];
+        else if (i + 1 < argc && option == "--top") topProcesses = max(0L, strtol(argv[++i], nullptr, 10));
+        else if (i + 1 < argc && option == "--interval") {
+            sampler.setInterval(strtof(argv[++i], nullptr));
+            intervalSet = true;
+        }
+        else if (i + 1 < argc && option == "--stat-fds") {
+            string budget = argv[++i];
+            sampler.setStatFdBudget(budget == "max" ? ProcessScanner::statFdLimit() : strtoul(budget.c_str(), nullptr, 10));
+        }
+        else if (option == "--io-uring") sampler.setBatchReads(true);
+        else if (option == "--delays") sampler.setDelayAccounting(true);
+        else if (option == "--batch") batch = true;
+        else if (i + 1 < argc && option == "--count") batchCount = strtoull(argv[++i], nullptr, 10);
+        else if (i + 1 < argc && option == "--format" && parseBatchFormat(argv[i + 1], batchFormat)) i++;
+        else if (i + 1 < argc && option == "--bench-scan" && parsePidCounts(argv[i + 1], benchPids)) i++;
+        else if (option == "--bench-parse") benchParse = true;
+        else {
+            fprintf(stderr,
+                    "Usage: %s [--record FILE | --replay FILE [--speed N]] [--interval SECONDS]\n"
+                    "       [--stat-fds N|max] [--io-uring] [--delays]\n"
+                    "       [--serve PORT|HOST:PORT|unix:PATH [--top N]]\n"
+                    "       [--batch [--format jsonl|csv] [--count N] [--top N]]\n"
+                    "       [--bench-scan PIDS[,PIDS...]] [--bench-parse]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (benchParse && !runParseBenchmark(stdout)) return 1;
+    if (!benchPids.empty()) return runScanBenchmark(stdout, benchPids) ? 0 : 1;
+    if (benchParse) return 0;
+    if (recordPath != nullptr && replayPath != nullptr) {
+        fprintf(stderr, "--record and --replay cannot be combined\n");
+        return 1;
+    }
+    if ((recordPath != nullptr && !sampler.recordTo(recordPath)) ||
+        (replayPath != nullptr && !sampler.replayFrom(replayPath, replaySpeed > 0.0f ? replaySpeed : 1.0f))) {
+        fprintf(stderr, "%s\n", sampler.getSourceStatus().c_str());
+        return 1;
+    }
+
+    // Headless output is one snapshot per process table, with every other
+    // collector in step, unless --interval says otherwise
+    if ((serveAddress != nullptr || batch) && !intervalSet) sampler.setInterval(sampler.getPeriod(CollectorProcesses));
+
+    // Headless: no SDL, no ImGui context, just the sampler and the exporter
+    if (serveAddress != nullptr) {
+        MetricsExporter exporter(topProcesses < 0 ? 20 : (size_t)topProcesses);
+        if (!exporter.listen(serveAddress)) {
+            fprintf(stderr, "%s\n", exporter.getStatus().c_str());
+            return 1;
+        }
+        fprintf(stderr, "%s\n", exporter.getStatus().c_str());
+        sampler.start();
+        exporter.run(sampler);
+        sampler.stop();
+        return 0;
+    }
+    if (batch) {
+        BatchWriter writer(stdout, batchFormat, topProcesses < 0 ? SIZE_MAX : (size_t)topProcesses);
+        sampler.start();
+        bool written = writer.run(sampler, batchCount);
+        sampler.stop();
+        return written ? 0 : 1;
+    }
+
+#ifdef MONITOR_HEADLESS
+    fprintf(stderr, "Built without the GUI; use --serve or --batch\n");
+    return 1;
+#else
 
-int main(int, char**) {
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_GAMECONTROLLER) != 0) {
         printf("Error: %s\n", SDL_GetError());
         return -1;
@@ -456,22 +691,79 @@ int main(int, char**) {
     ImVec4 clear_color = ImVec4(0.0f, 0.0f, 0.0f, 1.0f);
     bool done = false;
 
+    // The loop sleeps until there is input or a new snapshot, instead of
+    // redrawing at vsync. The sampler wakes it with a user event.
+    Uint32 snapshotEvent = SDL_RegisterEvents(1);
+    sampler.setPublishCallback([snapshotEvent] {
+        SDL_Event wake;
+        memset(&wake, 0, sizeof(wake));
+        wake.type = snapshotEvent;
+        SDL_PushEvent(&wake);
+    });
+    constexpr int FramesAfterInput = 3; // ImGui settles hover and layout changes over a few frames
+    constexpr Uint32 UnfocusedRedrawMs = 1000;
+    int pendingFrames = FramesAfterInput;
+    bool snapshotPending = false; // Arrived but not drawn yet, while unfocused
+    Uint32 lastFrame = 0;
+    sampler.start();
+
     while (!done) {
+        // A blinking text cursor still needs the odd frame, and a snapshot
+        // held back while unfocused is drawn once its second is up;
+        // otherwise only input or a snapshot wakes the loop
+        int timeout = 1000;
+        if (pendingFrames > 0) timeout = 0;
+        else if (io.WantTextInput) timeout = 500;
+        if (pendingFrames == 0 && snapshotPending) {
+            Uint32 elapsed = SDL_GetTicks() - lastFrame;
+            timeout = min(timeout, elapsed >= UnfocusedRedrawMs ? 0 : (int)(UnfocusedRedrawMs - elapsed));
+        }
+        bool timedOut = true;
         SDL_Event event;
-        while (SDL_PollEvent(&event)) {
-            ImGui_ImplSDL2_ProcessEvent(&event);
-            if (event.type == SDL_QUIT || (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_CLOSE))
-                done = true;
+        if (SDL_WaitEventTimeout(&event, timeout)) {
+            timedOut = false;
+            do {
+                if (event.type == snapshotEvent) {
+                    snapshotPending = true;
+                    continue;
+                }
+                ImGui_ImplSDL2_ProcessEvent(&event);
+                if (event.type == SDL_QUIT || (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_CLOSE))
+                    done = true;
+                pendingFrames = FramesAfterInput;
+            } while (SDL_PollEvent(&event));
+        }
+
+        // Nothing is drawn while minimized; without focus new data is
+        // shown at most once a second
+        Uint32 windowFlags = SDL_GetWindowFlags(window);
+        if (windowFlags & (SDL_WINDOW_MINIMIZED | SDL_WINDOW_HIDDEN)) {
+            // Restoring the window is an event of its own, and its frames
+            // show the newest snapshot
+            pendingFrames = 0;
+            snapshotPending = false;
+            continue;
         }
+        bool focused = windowFlags & SDL_WINDOW_INPUT_FOCUS;
+        if (snapshotPending && (focused || SDL_GetTicks() - lastFrame >= UnfocusedRedrawMs)) pendingFrames = max(pendingFrames, 1);
+        // A plain timeout with nothing new is not worth a frame
+        if (pendingFrames == 0 && !(timedOut && io.WantTextInput)) continue;
+        if (pendingFrames > 0) pendingFrames--;
+        snapshotPending = false;
+        lastFrame = SDL_GetTicks();
 
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplSDL2_NewFrame(window);
         ImGui::NewFrame();
 
+        // Pick up the newest snapshot, if any; never waits on the sampler
+        sampler.poll();
+        const SystemSnapshot& snapshot = sampler.current();
+
         ImVec2 mainDisplay = io.DisplaySize;
-        memoryProcessesWindow("== Memory and Processes ==", ImVec2((mainDisplay.x / 2) - 20, (mainDisplay.y / 2) + 30), ImVec2((mainDisplay.x / 2) + 10, 10));
-        systemWindow("== System ==", ImVec2((mainDisplay.x / 2) - 10, (mainDisplay.y / 2) + 30), ImVec2(10, 10));
-        networkWindow("== Network ==", ImVec2(mainDisplay.x - 20, (mainDisplay.y / 2) - 60), ImVec2(10, (mainDisplay.y / 2) + 50));
+        memoryProcessesWindow("== Memory and Processes ==", ImVec2((mainDisplay.x / 2) - 20, (mainDisplay.y / 2) + 30), ImVec2((mainDisplay.x / 2) + 10, 10), snapshot);
+        systemWindow("== System ==", ImVec2((mainDisplay.x / 2) - 10, (mainDisplay.y / 2) + 30), ImVec2(10, 10), snapshot);
+        networkWindow("== Network ==", ImVec2(mainDisplay.x - 20, (mainDisplay.y / 2) - 60), ImVec2(10, (mainDisplay.y / 2) + 50), snapshot);
 
         ImGui::Render();
         glViewport(0, 0, (int)io.DisplaySize.x, (int)io.DisplaySize.y);
@@ -481,6 +773,7 @@ int main(int, char**) {
         SDL_GL_SwapWindow(window);
     }
 
+    sampler.stop();
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplSDL2_Shutdown();
     ImGui::DestroyContext();
@@ -489,4 +782,5 @@ int main(int, char**) {
     SDL_Quit();
 
     return 0;
+#endif
 }
@@ -1,37 +1,37 @@
 #include "header.h"
-#include <sys/sysinfo.h>
 #include <sys/statvfs.h>
 #include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
 MemoryInfo SystemResourceTracker::getMemoryInfo() {
-    struct sysinfo info;
-    sysinfo(&info);
-
     // Read from /proc/meminfo for more accurate memory usage (htop-compatible)
     unsigned long memTotal = 0, memFree = 0;
     unsigned long buffers = 0, cached = 0, sReclaimable = 0, shmem = 0;
-    std::ifstream meminfo("/proc/meminfo");
-    std::string line;
-
-    while (std::getline(meminfo, line)) {
-        std::istringstream iss(line);
-        std::string key;
-        unsigned long value;
-        iss >> key >> value;
-
-        if (key == "MemTotal:") {
-            memTotal = value;
-        } else if (key == "MemFree:") {
-            memFree = value;
-        } else if (key == "Buffers:") {
-            buffers = value;
-        } else if (key == "Cached:") {
-            cached = value;
-        } else if (key == "SReclaimable:") {
-            sReclaimable = value;
-        } else if (key == "Shmem:") {
-            shmem = value;
+    unsigned long swapTotal = 0, swapFree = 0;
+    struct Field {
+        const char* key;
+        unsigned long* value;
+    };
+    const Field fields[] = {
+        {"MemTotal:", &memTotal}, {"MemFree:", &memFree}, {"Buffers:", &buffers},
+        {"Cached:", &cached}, {"SReclaimable:", &sReclaimable}, {"Shmem:", &shmem},
+        {"SwapTotal:", &swapTotal}, {"SwapFree:", &swapFree},
+    };
+    meminfo.read();
+    for (const char* line = meminfo.data(); *line;) {
+        for (const Field& field : fields) {
+            size_t length = strlen(field.key);
+            if (strncmp(line, field.key, length) == 0) {
+                *field.value = strtoul(line + length, nullptr, 10);
+                break;
+            }
         }
+        const char* end = strchr(line, '\n');
+        if (end == nullptr) break;
+        line = end + 1;
     }
 
     // Calculate memory usage similar to htop
@@ -43,11 +43,11 @@ MemoryInfo SystemResourceTracker::getMemoryInfo() {
     mem.total_ram = memTotal / 1024;  // Convert KB to MB
     mem.used_ram = usedMem / 1024;    // Convert KB to MB
 
-    mem.total_swap = info.totalswap / (1024 * 1024);
-    mem.used_swap = (info.totalswap - info.freeswap) / (1024 * 1024);
+    mem.total_swap = swapTotal / 1024;
+    mem.used_swap = (swapTotal - min(swapFree, swapTotal)) / 1024;
 
     mem.ram_percent = (float)mem.used_ram / mem.total_ram * 100.0f;
-    mem.swap_percent = info.totalswap > 0 ? (float)mem.used_swap / mem.total_swap * 100.0f : 0.0f;
+    mem.swap_percent = mem.total_swap > 0 ? (float)mem.used_swap / mem.total_swap * 100.0f : 0.0f;
 
     return mem;
 }
@@ -64,54 +64,480 @@ DiskInfo SystemResourceTracker::getDiskInfo() {
     return disk;
 }
 
-vector<Proc> SystemResourceTracker::getProcessList() {
-    vector<Proc> processes;
-    DIR *dir = opendir("/proc");
-    if (!dir) return processes;
+bool parseProcStat(const char* buffer, size_t length, Proc& process) {
+    const char* end = buffer + length;
+    const char* nameStart = static_cast<const char*>(memchr(buffer, '(', length));
+    if (!nameStart) return false;
+
+    // The name may itself contain ')', so the last one closes it
+    const char* nameEnd = end;
+    while (nameEnd > nameStart && *--nameEnd != ')') {}
+    if (nameEnd == nameStart) return false;
+    process.name.assign(nameStart + 1, nameEnd - nameStart - 1);
+
+    const char* p = nameEnd + 1;
+    while (p < end && *p == ' ') p++;
+    if (p >= end) return false;
+    process.state = *p++;
+
+    // Fields 4..52 of proc(5), stored as raw 64-bit values
+    constexpr int MaxFields = 49;
+    unsigned long long f[MaxFields] = {};
+    int count = 0;
+    while (count < MaxFields && p < end) {
+        while (p < end && *p == ' ') p++;
+        if (p >= end || *p == '\n') break;
+        bool negative = *p == '-';
+        if (negative) p++;
+        unsigned long long value = 0;
+        while (p < end && (unsigned)(*p - '0') < 10) value = value * 10 + (*p++ - '0');
+        f[count++] = negative ? 0 - value : value;
+    }
+    // Everything up to rss (field 24) is required
+    if (count < 21) return false;
+
+    process.ppid = (int)f[0];
+    process.pgrp = (int)f[1];
+    process.session = (int)f[2];
+    process.ttyNr = (int)f[3];
+    process.tpgid = (int)f[4];
+    process.flags = (unsigned int)f[5];
+    process.minflt = (long long)f[6];
+    process.cminflt = (long long)f[7];
+    process.majflt = (long long)f[8];
+    process.cmajflt = (long long)f[9];
+    process.utime = (long long)f[10];
+    process.stime = (long long)f[11];
+    process.cutime = (long long)f[12];
+    process.cstime = (long long)f[13];
+    process.priority = (long long)f[14];
+    process.nice = (long long)f[15];
+    process.numThreads = (int)f[16];
+    process.starttime = f[18];
+    process.vsize = (long long)f[19];
+    process.rss = (long long)f[20];
+    process.rsslim = f[21];
+    process.exitSignal = (int)f[34];
+    process.processor = (int)f[35];
+    process.rtPriority = (unsigned int)f[36];
+    process.policy = (unsigned int)f[37];
+    process.blkioTicks = f[38];
+    process.guestTime = (long long)f[39];
+    process.cguestTime = (long long)f[40];
+    return true;
+}
+
+// Fields the stat file does not have are filled in later by the sampler
+static void finishProcess(int pid, Proc& process) {
+    process.pid = pid;
+    process.cpuUsage = 0.0f;
+    process.cpuDelay = process.blkioDelay = process.swapinDelay = process.reclaimDelay = NoDelay;
+    process.cmdline = string_view();
+}
+
+// Writes "<pid>/<file>" for an openat() relative to /proc, without snprintf
+static void formatPidPath(char* path, int pid, const char* file) {
+    char digits[12];
+    int count = 0;
+    do {
+        digits[count++] = (char)('0' + pid % 10);
+        pid /= 10;
+    } while (pid > 0);
+    while (count > 0) *path++ = digits[--count];
+    *path++ = '/';
+    while (*file) *path++ = *file++;
+    *path = '\0';
+}
+
+// Reads and parses one /proc/<pid>/stat; false if the process is gone.
+// statFd is a descriptor held from an earlier scan or -1; a newly opened one
+// is kept in its place while spareFds has room, and it is -1 again on failure.
+static bool readProcess(int procFd, int pid, Proc& process, int& statFd, atomic<long>& spareFds) {
+    char buffer[2048];
+    ssize_t length = -1;
+    if (statFd >= 0) {
+        length = pread(statFd, buffer, sizeof(buffer), 0);
+        if (length <= 0) {
+            // ESRCH (or ENOENT) once the process has exited. The pid may already
+            // belong to a new process, so it is opened again below.
+            close(statFd);
+            statFd = -1;
+            spareFds.fetch_add(1, memory_order_relaxed);
+        }
+    }
+    if (statFd < 0) {
+        char path[32];
+        formatPidPath(path, pid, "stat");
+        int fd = openat(procFd, path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false; // Exited since it was listed
+        length = read(fd, buffer, sizeof(buffer));
+        if (length > 0 && spareFds.fetch_sub(1, memory_order_relaxed) > 0) {
+            statFd = fd;
+        } else {
+            if (length > 0) spareFds.fetch_add(1, memory_order_relaxed);
+            close(fd);
+        }
+    }
+    if (length <= 0 || !parseProcStat(buffer, length, process)) {
+        if (statFd >= 0) {
+            close(statFd);
+            statFd = -1;
+            spareFds.fetch_add(1, memory_order_relaxed);
+        }
+        return false;
+    }
+    finishProcess(pid, process);
+    return true;
+}
+
+bool readProcessCmdline(int procFd, int pid, string& cmdline) {
+    char path[32];
+    char buffer[4096]; // Longer command lines are cut off
+    cmdline.clear();
+    formatPidPath(path, pid, "cmdline");
+    int fd = openat(procFd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    ssize_t length = read(fd, buffer, sizeof(buffer));
+    close(fd);
+    if (length < 0) return false;
+    while (length > 0 && buffer[length - 1] == '\0') length--;
+    for (ssize_t i = 0; i < length; i++) {
+        if (buffer[i] == '\0') buffer[i] = ' ';
+    }
+    cmdline.assign(buffer, length);
+    return true;
+}
+
+bool listProcessIds(int procFd, vector<int>& pids) {
+    // glibc only gained a getdents64() wrapper in 2.30
+    struct LinuxDirent64 {
+        uint64_t ino;
+        int64_t offset;
+        unsigned short length;
+        unsigned char type;
+        char name[];
+    };
+    alignas(LinuxDirent64) char buffer[32768]; // About 1000 entries per call
+    if (lseek(procFd, 0, SEEK_SET) < 0) return false;
+    while (true) {
+        long bytes = syscall(SYS_getdents64, procFd, buffer, sizeof(buffer));
+        if (bytes < 0) return false;
+        if (bytes == 0) return true;
+        for (long offset = 0; offset < bytes;) {
+            const LinuxDirent64* entry = (const LinuxDirent64*)(buffer + offset);
+            offset += entry->length;
+            if (entry->type != DT_DIR) continue;
+            // Anything with a non-digit is not a process ("self", "sys", ...)
+            const char* name = entry->name;
+            int pid = 0;
+            while (*name >= '0' && *name <= '9') pid = pid * 10 + (*name++ - '0');
+            if (*name == '\0' && name != entry->name) pids.push_back(pid);
+        }
+    }
+}
+
+ProcessScanner::ProcessScanner(int threads)
+    : procFd(open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC)), statFdBudget(0), statFdGeneration(0), spareStatFds(0), batchReads(false), ringsOpen(false),
+      ringFailed(false), readStatus("Disabled"), threadCount(0), target(nullptr), jobGeneration(0),
+      pendingWorkers(0), stopping(false) {
+    setThreadCount(threads);
+}
+
+ProcessScanner::~ProcessScanner() {
+    stopPool();
+    closeStatFds(0);
+    if (procFd >= 0) close(procFd);
+}
+
+void ProcessScanner::stopPool() {
+    {
+        lock_guard<mutex> lock(jobMutex);
+        stopping = true;
+    }
+    jobReady.notify_all();
+    for (auto& t : pool) t.join();
+    pool.clear();
+    stopping = false;
+}
+
+void ProcessScanner::setThreadCount(int threads) {
+    threads = max(1, min(threads, 64));
+    if (threads == threadCount) return;
+    stopPool();
+    threadCount = threads;
+    workers.reset(new ScanWorker[threads]);
+    if (ringsOpen) openRings(); // New workers need rings of their own
+    // The calling thread acts as worker 0. New workers start at the current
+    // job, or they would wake at once for one that has finished and run into
+    // the next one unannounced.
+    for (int i = 1; i < threads; i++) pool.emplace_back(&ProcessScanner::workerLoop, this, i, jobGeneration);
+}
+
+int ProcessScanner::getThreadCount() const { return threadCount; }
+
+void ProcessScanner::setBatchReads(bool enabled) {
+    if (enabled == batchReads) return;
+    batchReads = enabled;
+    // Like delay accounting, a failed setup is only retried after switching off and on
+    if (enabled) openRings();
+    else closeRings("Disabled");
+}
+
+bool ProcessScanner::getBatchReads() const { return batchReads; }
+
+const string& ProcessScanner::getReadStatus() const { return readStatus; }
+
+unsigned long long ProcessScanner::getRingEnterCalls() const {
+    unsigned long long calls = 0;
+    for (int i = 0; i < threadCount; i++) calls += workers[i].ring.getEnterCalls();
+    return calls;
+}
+
+void ProcessScanner::openRings() {
+    for (int i = 0; i < threadCount; i++) {
+        ScanWorker& worker = workers[i];
+        if (!worker.ring.isOpen() && !worker.ring.open(ChunkSize)) {
+            string error = worker.ring.getStatus(); // close() resets it
+            closeRings(error);
+            return;
+        }
+        worker.readBuffers.resize(ChunkSize * 2048);
+        worker.readPaths.resize(ChunkSize * 32);
+    }
+    ringsOpen = true;
+    ringFailed.store(false);
+    readStatus = workers[0].ring.getStatus();
+}
 
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != nullptr) {
-        if (entry->d_type == DT_DIR && isdigit(entry->d_name[0])) {
-            string pid = entry->d_name;
-            string statPath = "/proc/" + pid + "/stat";
-            ifstream statFile(statPath);
+void ProcessScanner::closeRings(const string& status) {
+    for (int i = 0; i < threadCount; i++) workers[i].ring.close();
+    ringsOpen = false;
+    readStatus = status;
+}
+
+// One chunk through the worker's ring. Processes are opened synchronously
+// instead while the descriptor budget has room, so they can be kept.
+void ProcessScanner::readBatch(ScanWorker& self, size_t begin, size_t end) {
+    constexpr unsigned BufferSize = 2048, PathSize = 32;
+    self.reads.clear();
+    self.readRows.clear();
+    for (size_t i = begin; i < end; i++) {
+        int& fd = statFds[i];
+        if (fd < 0 && spareStatFds.load(memory_order_relaxed) > 0) {
+            if (!readProcess(procFd, pids[i], target->list[i], fd, spareStatFds)) target->list[i].pid = 0;
+            continue;
+        }
+        size_t slot = self.reads.size();
+        char* path = &self.readPaths[slot * PathSize];
+        if (fd < 0) formatPidPath(path, pids[i], "stat");
+        self.reads.push_back({fd, path, &self.readBuffers[slot * BufferSize], BufferSize, 0});
+        self.readRows.push_back(i);
+    }
+    if (self.reads.empty()) return;
+
+    bool read = self.ring.read(self.reads, procFd);
+    if (!read) ringFailed.store(true, memory_order_relaxed);
+    for (size_t slot = 0; slot < self.reads.size(); slot++) {
+        const UringRead& file = self.reads[slot];
+        size_t i = self.readRows[slot];
+        Proc& process = target->list[i];
+        if (read) {
+            if (file.result > 0 && parseProcStat(file.buffer, file.result, process)) {
+                finishProcess(pids[i], process);
+                continue;
+            }
+            if (file.fd < 0) {
+                process.pid = 0; // Exited since it was listed
+                continue;
+            }
+            // A held descriptor fails once its process exits, and the pid may
+            // have been reused since; readProcess opens it again
+            close(statFds[i]);
+            statFds[i] = -1;
+            spareStatFds.fetch_add(1, memory_order_relaxed);
+        }
+        if (!readProcess(procFd, pids[i], process, statFds[i], spareStatFds)) process.pid = 0;
+    }
+}
 
-            if (statFile.is_open()) {
-                Proc process;
-                process.pid = stoi(pid);
+size_t ProcessScanner::statFdLimit() {
+    // Half of what is left of the soft limit after a reserve for everything
+    // else (sockets, the history store, the display), so raising ulimit -n
+    // raises the budget with it
+    constexpr rlim_t Reserve = 64;
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) return 0;
+    rlim_t soft = limit.rlim_cur == RLIM_INFINITY ? 1 << 20 : limit.rlim_cur;
+    return soft > Reserve ? (size_t)(soft - Reserve) / 2 : 0;
+}
 
-                string line;
-                getline(statFile, line);
+void ProcessScanner::setStatFdBudget(size_t fds) {
+    statFdBudget = min(fds, statFdLimit());
+    if (statFdCache.size() > statFdBudget) closeStatFds(statFdBudget);
+}
 
-                size_t nameStart = line.find('(');
-                size_t nameEnd = line.rfind(')');
+size_t ProcessScanner::getStatFdBudget() const { return statFdBudget; }
 
-                if (nameStart != string::npos && nameEnd != string::npos) {
-                    process.name = line.substr(nameStart + 1, nameEnd - nameStart - 1);
+void ProcessScanner::closeStatFds(size_t keep) {
+    for (auto it = statFdCache.begin(); it != statFdCache.end() && statFdCache.size() > keep;) {
+        close(it->second.fd);
+        it = statFdCache.erase(it);
+    }
+}
 
-                    istringstream iss(line.substr(nameEnd + 1));
-                    string field;
-                    vector<string> fields;
+void ProcessScanner::updateStatFdCache(ProcessSnapshot& snapshot) {
+    // Workers closed the descriptors of exited processes and left new ones in
+    // statFds; an entry whose descriptor no longer matches was closed already
+    statFdGeneration++;
+    for (size_t i = 0; i < pids.size(); i++) {
+        int fd = statFds[i];
+        auto it = statFdCache.find(pids[i]);
+        if (it != statFdCache.end() && it->second.fd != fd) {
+            statFdCache.erase(it);
+            it = statFdCache.end();
+        }
+        if (fd < 0) continue;
+        const Proc& process = snapshot.list[i];
+        if (it == statFdCache.end()) {
+            statFdCache.emplace(pids[i], CachedStatFd{fd, process.starttime, statFdGeneration});
+        } else if (it->second.starttime != process.starttime) {
+            close(fd); // Not the process it was opened for; reopened next scan
+            statFdCache.erase(it);
+        } else {
+            it->second.generation = statFdGeneration;
+        }
+    }
+    // Processes missing from this scan have exited
+    for (auto it = statFdCache.begin(); it != statFdCache.end();) {
+        if (it->second.generation == statFdGeneration) {
+            ++it;
+            continue;
+        }
+        close(it->second.fd);
+        it = statFdCache.erase(it);
+    }
+    snapshot.statFds = (int)statFdCache.size();
+    snapshot.statFdBudget = (int)statFdBudget;
+}
 
-                    while (iss >> field) {
-                        fields.push_back(field);
-                    }
+void ProcessScanner::listPids() {
+    pids.clear();
+    if (procFd >= 0) listProcessIds(procFd, pids);
+}
 
-                    if (fields.size() >= 24) {
-                        process.state = fields[0][0];
-                        process.vsize = stoll(fields[20]);
-                        process.rss = stoll(fields[21]);
-                        process.utime = stoll(fields[11]);
-                        process.stime = stoll(fields[12]);
-                    }
+void ProcessScanner::scanChunks(int worker) {
+    ScanWorker& self = workers[worker];
+    self.states.fill(0);
+    self.total = 0;
 
-                    processes.push_back(process);
+    // Drain our own chunks first, then steal from the other workers
+    for (int offset = 0; offset < threadCount; offset++) {
+        ScanWorker& victim = workers[(worker + offset) % threadCount];
+        size_t chunk;
+        while ((chunk = victim.nextChunk.fetch_add(1, memory_order_relaxed)) < victim.endChunk) {
+            size_t begin = chunk * ChunkSize, end = min(pids.size(), (chunk + 1) * ChunkSize);
+            if (ringsOpen) {
+                readBatch(self, begin, end);
+            } else {
+                for (size_t i = begin; i < end; i++) {
+                    // A pid of 0 is dropped when the results are compacted
+                    if (!readProcess(procFd, pids[i], target->list[i], statFds[i], spareStatFds)) target->list[i].pid = 0;
                 }
-                statFile.close();
             }
+            for (size_t i = begin; i < end; i++) {
+                const Proc& process = target->list[i];
+                if (process.pid == 0) continue;
+                // Map 'I' (idle) to 'S' (sleeping) to match top's behavior
+                char state = process.state == 'I' ? 'S' : process.state;
+                self.states[state & 0x7f]++;
+                self.total++;
+            }
+        }
+    }
+}
+
+void ProcessScanner::workerLoop(int worker, unsigned int seen) {
+    while (true) {
+        {
+            unique_lock<mutex> lock(jobMutex);
+            jobReady.wait(lock, [&] { return stopping || jobGeneration != seen; });
+            if (stopping) return;
+            seen = jobGeneration;
+        }
+        scanChunks(worker);
+        lock_guard<mutex> lock(jobMutex);
+        if (--pendingWorkers == 0) jobDone.notify_one();
+    }
+}
+
+void ProcessScanner::scan(ProcessSnapshot& snapshot) {
+    auto started = chrono::steady_clock::now();
+    listPids();
+    scanPids(snapshot);
+    snapshot.scanMilliseconds = chrono::duration<float, milli>(chrono::steady_clock::now() - started).count();
+}
+
+void ProcessScanner::scan(ProcessSnapshot& snapshot, const vector<int>& knownPids) {
+    auto started = chrono::steady_clock::now();
+    pids.assign(knownPids.begin(), knownPids.end());
+    scanPids(snapshot);
+    snapshot.scanMilliseconds = chrono::duration<float, milli>(chrono::steady_clock::now() - started).count();
+}
+
+void ProcessScanner::scanPids(ProcessSnapshot& snapshot) {
+    // Every PID gets a slot up front (reusing last refresh's Proc objects),
+    // so workers write their own ranges without any locking
+    target = &snapshot;
+    snapshot.list.resize(pids.size());
+    statFds.resize(pids.size());
+    for (size_t i = 0; i < pids.size(); i++) {
+        auto it = statFdCache.find(pids[i]);
+        statFds[i] = it != statFdCache.end() ? it->second.fd : -1;
+    }
+    spareStatFds.store((long)statFdBudget - (long)statFdCache.size(), memory_order_relaxed);
+    size_t chunks = (pids.size() + ChunkSize - 1) / ChunkSize;
+    int active = (int)min<size_t>(threadCount, max<size_t>(chunks, 1));
+    for (int i = 0; i < threadCount; i++) {
+        workers[i].nextChunk.store(chunks * i / active, memory_order_relaxed);
+        workers[i].endChunk = i < active ? chunks * (i + 1) / active : 0;
+    }
+
+    if (threadCount > 1 && active > 1) {
+        {
+            lock_guard<mutex> lock(jobMutex);
+            pendingWorkers = threadCount - 1;
+            jobGeneration++;
+        }
+        jobReady.notify_all();
+        scanChunks(0);
+        unique_lock<mutex> lock(jobMutex);
+        jobDone.wait(lock, [this] { return pendingWorkers == 0; });
+    } else {
+        for (int i = 1; i < threadCount; i++) {
+            workers[i].states.fill(0);
+            workers[i].total = 0;
         }
+        scanChunks(0);
+    }
+    target = nullptr;
+    updateStatFdCache(snapshot);
+    snapshot.batchedReads = ringsOpen;
+    if (ringFailed.load()) closeRings("io_uring failed, reading synchronously");
+
+    // Merge the per-worker histograms and drop processes that vanished mid-scan
+    snapshot.states.fill(0);
+    snapshot.total = 0;
+    for (int i = 0; i < threadCount; i++) {
+        for (size_t state = 0; state < snapshot.states.size(); state++) snapshot.states[state] += workers[i].states[state];
+        snapshot.total += workers[i].total;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < snapshot.list.size(); i++) {
+        if (snapshot.list[i].pid == 0) continue;
+        if (count != i) swap(snapshot.list[count], snapshot.list[i]);
+        count++;
     }
+    snapshot.list.resize(count);
 
-    closedir(dir);
-    return processes;
+    snapshot.scanThreads = threadCount;
 }
@@ -0,0 +1,457 @@
+#include "header.h"
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include <linux/genetlink.h>
+#include <linux/taskstats.h>
+
+ProcEventListener::ProcEventListener()
+    : sock(-1), running(false), overflowed(false), forkCount(0), exitCount(0) {}
+
+ProcEventListener::~ProcEventListener() { stop(); }
+
+bool ProcEventListener::subscribe(bool enable) {
+    // nlmsghdr + cn_msg + the multicast op as cn_msg's payload
+    alignas(struct nlmsghdr) char request[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op))];
+    memset(request, 0, sizeof(request));
+    struct nlmsghdr* header = (struct nlmsghdr*)request;
+    header->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op));
+    header->nlmsg_type = NLMSG_DONE;
+    header->nlmsg_pid = getpid();
+    struct cn_msg* message = (struct cn_msg*)NLMSG_DATA(header);
+    message->id.idx = CN_IDX_PROC;
+    message->id.val = CN_VAL_PROC;
+    message->len = sizeof(enum proc_cn_mcast_op);
+    enum proc_cn_mcast_op op = enable ? PROC_CN_MCAST_LISTEN : PROC_CN_MCAST_IGNORE;
+    memcpy(message->data, &op, sizeof(op));
+    return send(sock, request, header->nlmsg_len, 0) == (ssize_t)header->nlmsg_len;
+}
+
+bool ProcEventListener::start() {
+    if (running.load()) return true;
+
+    sock = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+    if (sock < 0) return false;
+
+    struct sockaddr_nl address;
+    memset(&address, 0, sizeof(address));
+    address.nl_family = AF_NETLINK;
+    address.nl_groups = CN_IDX_PROC;
+    address.nl_pid = 0; // Let the kernel pick a unique port id
+    if (bind(sock, (struct sockaddr*)&address, sizeof(address)) < 0 || !subscribe(true)) {
+        close(sock);
+        sock = -1;
+        return false;
+    }
+
+    // Events queue up in the socket from here on, so seeding the set from
+    // /proc now cannot miss a process; duplicates are harmless
+    {
+        lock_guard<mutex> lock(stateMutex);
+        livePids.clear();
+        unseen.clear();
+        exited.clear();
+        exitedDuringRescan.clear();
+        int procFd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (procFd >= 0) {
+            vector<int> pids;
+            listProcessIds(procFd, pids);
+            livePids.insert(pids.begin(), pids.end());
+            close(procFd);
+        }
+    }
+    overflowed.store(false);
+    running.store(true);
+    receiver = thread(&ProcEventListener::receiveLoop, this);
+    return true;
+}
+
+void ProcEventListener::stop() {
+    if (!running.exchange(false)) return;
+    if (receiver.joinable()) receiver.join();
+    subscribe(false);
+    close(sock);
+    sock = -1;
+}
+
+bool ProcEventListener::isActive() const { return running.load(); }
+
+// Best effort: the process may already be gone, leaving name empty
+static void readComm(int pid, array<char, 16>& name) {
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/%d/comm", pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    ssize_t length = read(fd, name.data(), name.size() - 1);
+    close(fd);
+    if (length <= 0) return;
+    if (name[length - 1] == '\n') length--;
+    name[length] = '\0';
+}
+
+void ProcEventListener::receiveLoop() {
+    alignas(struct nlmsghdr) char buffer[8192];
+    struct pollfd descriptor = {sock, POLLIN, 0};
+    vector<struct proc_event> events;
+    vector<array<char, 16>> names;
+    while (running.load()) {
+        // Wake up periodically so stop() never waits long
+        if (poll(&descriptor, 1, 200) <= 0) continue;
+        ssize_t length = recv(sock, buffer, sizeof(buffer), 0);
+        if (length < 0) {
+            // The kernel dropped events; the live set can no longer be trusted
+            if (errno == ENOBUFS) overflowed.store(true);
+            continue;
+        }
+
+        events.clear();
+        for (struct nlmsghdr* header = (struct nlmsghdr*)buffer; NLMSG_OK(header, length);
+             header = NLMSG_NEXT(header, length)) {
+            if (header->nlmsg_type == NLMSG_ERROR || header->nlmsg_type == NLMSG_NOOP) continue;
+            struct cn_msg* message = (struct cn_msg*)NLMSG_DATA(header);
+            if (message->id.idx != CN_IDX_PROC || message->id.val != CN_VAL_PROC) continue;
+            // The payload sits at a 4-byte offset; copy it out to get proc_event's alignment
+            struct proc_event event;
+            memset(&event, 0, sizeof(event));
+            memcpy(&event, message->data, min<size_t>(message->len, sizeof(event)));
+            events.push_back(event);
+        }
+
+        // Names are read from /proc before taking the lock, so a burst of
+        // forks never holds up the sampler on file reads
+        names.resize(events.size());
+        for (size_t i = 0; i < events.size(); i++) {
+            const struct proc_event& event = events[i];
+            names[i][0] = '\0';
+            if (event.what == proc_event::PROC_EVENT_FORK && event.event_data.fork.child_pid == event.event_data.fork.child_tgid)
+                readComm(event.event_data.fork.child_pid, names[i]);
+            else if (event.what == proc_event::PROC_EVENT_EXEC)
+                readComm(event.event_data.exec.process_tgid, names[i]);
+        }
+
+        lock_guard<mutex> lock(stateMutex);
+        for (size_t i = 0; i < events.size(); i++) handleEvent(events[i], names[i].data());
+    }
+}
+
+// Called with stateMutex held; name is the comm read for a fork or exec
+void ProcEventListener::handleEvent(const struct proc_event& event, const char* name) {
+    switch (event.what) {
+    case proc_event::PROC_EVENT_FORK: {
+        // New threads share their parent's tgid; only new processes matter here
+        int pid = event.event_data.fork.child_pid;
+        if (pid != event.event_data.fork.child_tgid) break;
+        forkCount++;
+        livePids.insert(pid);
+        PendingProcess& pending = unseen[pid];
+        pending.born = chrono::steady_clock::now();
+        pending.ppid = event.event_data.fork.parent_tgid;
+        // The child still carries its parent's name until it execs
+        snprintf(pending.name, sizeof(pending.name), "%s", name);
+        break;
+    }
+    case proc_event::PROC_EVENT_EXEC: {
+        int pid = event.event_data.exec.process_tgid;
+        auto it = unseen.find(pid);
+        if (it != unseen.end() && name[0] != '\0') snprintf(it->second.name, sizeof(it->second.name), "%s", name);
+        break;
+    }
+    case proc_event::PROC_EVENT_COMM: {
+        // Sent on prctl(PR_SET_NAME)
+        int pid = event.event_data.comm.process_tgid;
+        auto it = unseen.find(pid);
+        if (it != unseen.end() && pid == event.event_data.comm.process_pid) {
+            memcpy(it->second.name, event.event_data.comm.comm, sizeof(it->second.name));
+            it->second.name[sizeof(it->second.name) - 1] = '\0';
+        }
+        break;
+    }
+    case proc_event::PROC_EVENT_EXIT: {
+        int pid = event.event_data.exit.process_pid;
+        if (pid != event.event_data.exit.process_tgid) break;
+        exitCount++;
+        livePids.erase(pid);
+        // A rescan running now may still have seen it; reseed() must not bring it back
+        if (overflowed.load()) exitedDuringRescan.insert(pid);
+        auto it = unseen.find(pid);
+        if (it == unseen.end()) break;
+
+        // Gone before any scan saw it
+        ShortLivedProcess process;
+        process.pid = pid;
+        process.ppid = it->second.ppid;
+        process.name = it->second.name;
+        process.lifetimeMs = chrono::duration<float, milli>(chrono::steady_clock::now() - it->second.born).count();
+        process.exitCode = (int)event.event_data.exit.exit_code;
+        exited.push_back(std::move(process));
+        unseen.erase(it);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+bool ProcEventListener::copyLivePids(vector<int>& pids) {
+    if (overflowed.load()) return false;
+    lock_guard<mutex> lock(stateMutex);
+    pids.assign(livePids.begin(), livePids.end());
+    return true;
+}
+
+// Events kept coming while the rescan ran, so its result is merged in
+// rather than replacing the set: forks it missed stay, and processes it saw
+// that have exited since are left out. New processes it did not see stay
+// pending, so their exit can still be reported.
+void ProcEventListener::reseed(const vector<Proc>& scanned) {
+    lock_guard<mutex> lock(stateMutex);
+    for (const Proc& process : scanned) {
+        if (!exitedDuringRescan.count(process.pid)) livePids.insert(process.pid);
+    }
+    exitedDuringRescan.clear();
+    overflowed.store(false);
+}
+
+// scanned holds the requested pids that could still be read, in the same
+// order. One that could not be read is gone even if an overflow lost its
+// exit event, unless it is a new process still waiting for its first scan.
+void ProcEventListener::acknowledge(const vector<int>& requested, const vector<Proc>& scanned) {
+    lock_guard<mutex> lock(stateMutex);
+    size_t next = 0;
+    for (int pid : requested) {
+        if (next < scanned.size() && scanned[next].pid == pid) {
+            unseen.erase(pid);
+            next++;
+        } else if (!unseen.count(pid)) {
+            livePids.erase(pid);
+        }
+    }
+}
+
+void ProcEventListener::takeExited(vector<ShortLivedProcess>& out) {
+    lock_guard<mutex> lock(stateMutex);
+    for (auto& process : exited) out.push_back(std::move(process));
+    exited.clear();
+}
+
+unsigned long long ProcEventListener::getForkCount() {
+    lock_guard<mutex> lock(stateMutex);
+    return forkCount;
+}
+
+unsigned long long ProcEventListener::getExitCount() {
+    lock_guard<mutex> lock(stateMutex);
+    return exitCount;
+}
+
+TaskstatsCollector::TaskstatsCollector()
+    : sock(-1), familyId(0), sequence(0), status("Not started"), generation(0), cursor(0) {}
+
+TaskstatsCollector::~TaskstatsCollector() { close(); }
+
+bool TaskstatsCollector::sendRequest(int type, int command, int attribute, const void* data, int length) {
+    // nlmsghdr + genlmsghdr + one attribute
+    memset(buffer, 0, NLMSG_SPACE(GENL_HDRLEN + NLA_HDRLEN + NLA_ALIGN(length)));
+    struct nlmsghdr* header = (struct nlmsghdr*)buffer;
+    header->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+    header->nlmsg_type = type;
+    header->nlmsg_flags = NLM_F_REQUEST;
+    header->nlmsg_seq = ++sequence;
+    header->nlmsg_pid = 0;
+    struct genlmsghdr* generic = (struct genlmsghdr*)NLMSG_DATA(header);
+    generic->cmd = command;
+    generic->version = 1;
+
+    struct nlattr* attr = (struct nlattr*)((char*)generic + GENL_HDRLEN);
+    attr->nla_type = attribute;
+    attr->nla_len = NLA_HDRLEN + length;
+    memcpy((char*)attr + NLA_HDRLEN, data, length);
+    header->nlmsg_len += NLA_ALIGN(attr->nla_len);
+
+    struct sockaddr_nl kernel;
+    memset(&kernel, 0, sizeof(kernel));
+    kernel.nl_family = AF_NETLINK;
+    ssize_t sent;
+    do {
+        sent = sendto(sock, buffer, header->nlmsg_len, 0, (struct sockaddr*)&kernel, sizeof(kernel));
+    } while (sent < 0 && errno == EINTR);
+    return sent == (ssize_t)header->nlmsg_len;
+}
+
+// Returns the reply length, or a negative errno from the kernel
+int TaskstatsCollector::receiveReply() {
+    while (true) {
+        ssize_t length = recv(sock, buffer, sizeof(buffer), 0);
+        if (length < 0) {
+            if (errno == EINTR) continue;
+            return -errno;
+        }
+        struct nlmsghdr* header = (struct nlmsghdr*)buffer;
+        if (!NLMSG_OK(header, length)) return -EBADMSG;
+        if (header->nlmsg_seq != sequence) continue; // Stale reply to an earlier request
+        if (header->nlmsg_type == NLMSG_ERROR) {
+            struct nlmsgerr* error = (struct nlmsgerr*)NLMSG_DATA(header);
+            return error->error < 0 ? error->error : -EBADMSG;
+        }
+        return (int)length;
+    }
+}
+
+int TaskstatsCollector::resolveFamily() {
+    static const char name[] = TASKSTATS_GENL_NAME;
+    if (!sendRequest(GENL_ID_CTRL, CTRL_CMD_GETFAMILY, CTRL_ATTR_FAMILY_NAME, name, sizeof(name))) return -errno;
+    int length = receiveReply();
+    if (length < 0) return length;
+
+    struct nlmsghdr* header = (struct nlmsghdr*)buffer;
+    int remaining = header->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+    struct nlattr* attr = (struct nlattr*)((char*)NLMSG_DATA(header) + GENL_HDRLEN);
+    while (remaining >= NLA_HDRLEN && attr->nla_len >= NLA_HDRLEN && attr->nla_len <= remaining) {
+        if (attr->nla_type == CTRL_ATTR_FAMILY_ID) return *(__u16*)((char*)attr + NLA_HDRLEN);
+        remaining -= NLA_ALIGN(attr->nla_len);
+        attr = (struct nlattr*)((char*)attr + NLA_ALIGN(attr->nla_len));
+    }
+    return -ENOENT;
+}
+
+bool TaskstatsCollector::open() {
+    if (sock >= 0) return true;
+
+    sock = socket(PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+    if (sock < 0) {
+        status = "Generic netlink unavailable";
+        return false;
+    }
+    struct sockaddr_nl address;
+    memset(&address, 0, sizeof(address));
+    address.nl_family = AF_NETLINK;
+    // A receive timeout keeps a lost reply from stalling the sampler
+    struct timeval timeout = {0, 100000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (bind(sock, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        status = "Generic netlink unavailable";
+        close();
+        return false;
+    }
+
+    familyId = resolveFamily();
+    if (familyId <= 0) {
+        status = "Kernel built without CONFIG_TASKSTATS";
+        close();
+        return false;
+    }
+
+    // Probe with our own process to find out about permissions early
+    Proc self{};
+    self.pid = getpid();
+    if (!query(self)) {
+        close();
+        return false;
+    }
+
+    int enabled = 1;
+    FILE* sysctl = fopen("/proc/sys/kernel/task_delayacct", "r");
+    if (sysctl) {
+        if (fscanf(sysctl, "%d", &enabled) != 1) enabled = 1;
+        fclose(sysctl);
+    }
+    status = enabled ? "Delay accounting active" : "kernel.task_delayacct is off, delays stay at zero";
+    return true;
+}
+
+void TaskstatsCollector::close() {
+    if (sock >= 0) ::close(sock);
+    sock = -1;
+    familyId = 0;
+}
+
+bool TaskstatsCollector::isAvailable() const { return sock >= 0; }
+
+const string& TaskstatsCollector::getStatus() const { return status; }
+
+bool TaskstatsCollector::query(Proc& process) {
+    // Ask for the whole thread group so every thread's delays are summed
+    __u32 tgid = process.pid;
+    if (!sendRequest(familyId, TASKSTATS_CMD_GET, TASKSTATS_CMD_ATTR_TGID, &tgid, sizeof(tgid))) return false;
+    int length = receiveReply();
+    if (length < 0) {
+        if (length == -EPERM || length == -EACCES) status = "Needs CAP_NET_ADMIN";
+        else if (length != -ESRCH) status = string("Taskstats query failed: ") + strerror(-length);
+        return false;
+    }
+
+    // Walk down to TASKSTATS_TYPE_AGGR_TGID -> TASKSTATS_TYPE_STATS
+    struct nlmsghdr* header = (struct nlmsghdr*)buffer;
+    int remaining = header->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+    struct nlattr* attr = (struct nlattr*)((char*)NLMSG_DATA(header) + GENL_HDRLEN);
+    while (remaining >= NLA_HDRLEN && attr->nla_len >= NLA_HDRLEN && attr->nla_len <= remaining) {
+        if (attr->nla_type == TASKSTATS_TYPE_AGGR_TGID || attr->nla_type == TASKSTATS_TYPE_AGGR_PID) {
+            remaining = attr->nla_len - NLA_HDRLEN;
+            attr = (struct nlattr*)((char*)attr + NLA_HDRLEN);
+            continue;
+        }
+        if (attr->nla_type == TASKSTATS_TYPE_STATS) {
+            // Older kernels send a shorter struct; missing fields read as zero
+            struct taskstats stats;
+            memset(&stats, 0, sizeof(stats));
+            memcpy(&stats, (char*)attr + NLA_HDRLEN, min<size_t>(attr->nla_len - NLA_HDRLEN, sizeof(stats)));
+            process.cpuDelay = stats.cpu_delay_total;
+            process.blkioDelay = stats.blkio_delay_total;
+            process.swapinDelay = stats.swapin_delay_total;
+            process.reclaimDelay = stats.freepages_delay_total;
+            return true;
+        }
+        remaining -= NLA_ALIGN(attr->nla_len);
+        attr = (struct nlattr*)((char*)attr + NLA_ALIGN(attr->nla_len));
+    }
+    return false;
+}
+
+size_t TaskstatsCollector::queryAll(vector<Proc>& processes, float budgetMs) {
+    // Requests are answered inside sendto(), so keeping several in flight
+    // does not help; the deadline is what bounds a scan
+    auto deadline = chrono::steady_clock::now() + chrono::microseconds((long long)(budgetMs * 1000.0f));
+    size_t count = processes.size();
+    size_t start = count > 0 ? cursor % count : 0;
+    size_t reached = 0, refreshed = 0;
+    for (; reached < count && chrono::steady_clock::now() < deadline; reached++) {
+        if (query(processes[(start + reached) % count])) refreshed++;
+    }
+    cursor = start + reached;
+
+    // Rows reached update the cache, the rest are filled from it. A failed
+    // query leaves the row at NoDelay and out of the cache, so its totals
+    // show as unavailable rather than zero.
+    generation++;
+    for (size_t k = 0; k < count; k++) {
+        Proc& process = processes[(start + k) % count];
+        if (k < reached && process.cpuDelay == NoDelay) {
+            cache.erase(process.pid);
+            continue;
+        }
+        CachedDelays& cached = cache[process.pid];
+        if (k < reached) {
+            cached = {process.starttime, process.cpuDelay, process.blkioDelay, process.swapinDelay,
+                      process.reclaimDelay, generation};
+            continue;
+        }
+        if (cached.generation != 0 && cached.starttime == process.starttime) {
+            process.cpuDelay = cached.cpu;
+            process.blkioDelay = cached.blkio;
+            process.swapinDelay = cached.swapin;
+            process.reclaimDelay = cached.reclaim;
+        }
+        cached.starttime = process.starttime;
+        cached.generation = generation;
+    }
+    for (auto it = cache.begin(); it != cache.end();) {
+        if (it->second.generation != generation) it = cache.erase(it);
+        else ++it;
+    }
+    return refreshed;
+}
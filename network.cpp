@@ -1,4 +1,5 @@
 #include "header.h"
+#include <cstring>
 #include <arpa/inet.h>
 #include <net/if.h>
 #include <sys/ioctl.h>
@@ -42,57 +43,50 @@ Networks NetworkTracker::getNetworkInterfaces() {
     return nets;
 }
 
-map<string, RX> NetworkTracker::getNetworkRX() {
-    map<string, RX> rxStats;
-    ifstream netDevFile("/proc/net/dev");
-    string line;
-    
-    getline(netDevFile, line); // Skip header line
-    getline(netDevFile, line); // Skip second header line
+void NetworkTracker::getNetworkStats(map<string, RX>& rxStats, map<string, TX>& txStats) {
+    rxStats.clear();
+    txStats.clear();
+    if (!netDev.read()) return;
 
-    while (getline(netDevFile, line)) {
-        istringstream iss(line);
-        string interfaceName;
-        getline(iss, interfaceName, ':');
-        interfaceName = interfaceName.substr(interfaceName.find_first_not_of(" \t"));
-        
-        RX rx;
-        iss >> rx.bytes >> rx.packets >> rx.errs >> rx.drop 
-            >> rx.fifo >> rx.frame >> rx.compressed >> rx.multicast;
-        
-        rxStats[interfaceName] = rx;
+    // Two header lines, then "  name: 8 receive fields 8 transmit fields"
+    const char* line = netDev.data();
+    for (int skip = 0; skip < 2 && line != nullptr; skip++) {
+        line = strchr(line, '\n');
+        if (line != nullptr) line++;
     }
+    while (line != nullptr && *line) {
+        const char* colon = strchr(line, ':');
+        const char* end = strchr(line, '\n');
+        if (colon == nullptr || (end != nullptr && colon > end)) break;
+        const char* nameStart = line + strspn(line, " \t");
+        string interfaceName(nameStart, colon - nameStart);
 
-    netDevFile.close();
-    return rxStats;
+        long long values[16] = {};
+        char* cursor = (char*)colon + 1;
+        for (long long& value : values) value = strtoll(cursor, &cursor, 10);
+        RX& rx = rxStats[interfaceName];
+        rx = {(int)values[0], (int)values[1], (int)values[2], (int)values[3],
+              (int)values[4], (int)values[5], (int)values[6], (int)values[7]};
+        TX& tx = txStats[interfaceName];
+        tx = {(int)values[8], (int)values[9], (int)values[10], (int)values[11],
+              (int)values[12], (int)values[13], (int)values[14], (int)values[15]};
+        line = end != nullptr ? end + 1 : nullptr;
+    }
 }
 
-map<string, TX> NetworkTracker::getNetworkTX() {
-    map<string, TX> txStats;
-    ifstream netDevFile("/proc/net/dev");
-    string line;
-    
-    getline(netDevFile, line); // Skip header line
-    getline(netDevFile, line); // Skip second header line
-
-    while (getline(netDevFile, line)) {
-        istringstream iss(line);
-        string interfaceName;
-        getline(iss, interfaceName, ':');
-        interfaceName = interfaceName.substr(interfaceName.find_first_not_of(" \t"));
-        
-        long long rxDummy;
-        for (int i = 0; i < 8; ++i) {
-            iss >> rxDummy;
+void NetworkRate::update(const map<string, RX>& rxStats, const map<string, TX>& txStats, float time) {
+    for (auto& [iface, rx] : rxStats) {
+        if (lastRX.count(iface)) {
+            float dt = time - lastRX[iface].second;
+            rxRate[iface] = dt > 0 ? (rx.bytes - lastRX[iface].first) / dt : 0;
         }
-        
-        TX tx;
-        iss >> tx.bytes >> tx.packets >> tx.errs >> tx.drop 
-            >> tx.fifo >> tx.colls >> tx.carrier >> tx.compressed;
-        
-        txStats[interfaceName] = tx;
+        lastRX[iface] = {rx.bytes, time};
+    }
+    for (auto& [iface, tx] : txStats) {
+        if (lastTX.count(iface)) {
+            float dt = time - lastTX[iface].second;
+            txRate[iface] = dt > 0 ? (tx.bytes - lastTX[iface].first) / dt : 0;
+        }
+        lastTX[iface] = {tx.bytes, time};
     }
-
-    netDevFile.close();
-    return txStats;
 }
\ No newline at end of file
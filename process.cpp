@@ -0,0 +1,520 @@
+#include "header.h"
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+NameInterner::NameInterner() : count(0) {
+    for (auto& chunk : chunks) chunk.store(nullptr, memory_order_relaxed);
+    intern(""); // Handle 0 is the empty name
+}
+
+NameInterner::~NameInterner() {
+    for (auto& chunk : chunks) delete[] chunk.load(memory_order_relaxed);
+}
+
+uint32_t NameInterner::intern(const string& text) {
+    string_view key(text.data(), min(text.size(), sizeof(Entry::name) - 1));
+    auto it = lookup.find(key);
+    if (it != lookup.end()) return it->second;
+
+    // Out of room: everything new shares the empty name rather than growing forever
+    uint32_t id = count.load(memory_order_relaxed);
+    if (id == MaxChunks * ChunkSize) return 0;
+    if ((id & (ChunkSize - 1)) == 0) chunks[id >> ChunkBits].store(new Entry[ChunkSize], memory_order_release);
+
+    Entry& slot = entry(id);
+    memcpy(slot.name, key.data(), key.size());
+    slot.name[key.size()] = '\0';
+    for (size_t i = 0; i <= key.size(); i++) slot.lower[i] = (char)tolower((unsigned char)slot.name[i]);
+    lookup.emplace(string_view(slot.name, key.size()), id);
+    count.store(id + 1, memory_order_release);
+    return id;
+}
+
+void ProcessTable::assign(const ProcessSnapshot& snapshot, NameInterner& interner) {
+    size_t rows = snapshot.list.size();
+    pid.resize(rows);
+    ppid.resize(rows);
+    state.resize(rows);
+    name.resize(rows);
+    rss.resize(rows);
+    vsize.resize(rows);
+    utime.resize(rows);
+    stime.resize(rows);
+    starttime.resize(rows);
+    numThreads.resize(rows);
+    cpu.resize(rows);
+    cpuDelay.resize(rows);
+    blkioDelay.resize(rows);
+    swapinDelay.resize(rows);
+    reclaimDelay.resize(rows);
+
+    for (size_t row = 0; row < rows; row++) {
+        const Proc& process = snapshot.list[row];
+        pid[row] = process.pid;
+        ppid[row] = process.ppid;
+        state[row] = process.state;
+        name[row] = interner.intern(process.name);
+        rss[row] = process.rss;
+        vsize[row] = process.vsize;
+        utime[row] = process.utime;
+        stime[row] = process.stime;
+        starttime[row] = process.starttime;
+        numThreads[row] = process.numThreads;
+        cpu[row] = process.cpuUsage;
+        cpuDelay[row] = process.cpuDelay;
+        blkioDelay[row] = process.blkioDelay;
+        swapinDelay[row] = process.swapinDelay;
+        reclaimDelay[row] = process.reclaimDelay;
+    }
+    names = &interner;
+
+    cmdlineOffset.resize(rows + 1);
+    cmdlineText.clear();
+    for (size_t row = 0; row < rows; row++) {
+        string_view text = snapshot.list[row].cmdline;
+        cmdlineOffset[row] = (uint32_t)cmdlineText.size();
+        cmdlineText.insert(cmdlineText.end(), text.begin(), text.end());
+        cmdlineText.push_back('\0');
+    }
+    cmdlineOffset[rows] = (uint32_t)cmdlineText.size();
+    cmdlineLower.resize(cmdlineText.size());
+    for (size_t i = 0; i < cmdlineText.size(); i++) cmdlineLower[i] = (char)tolower((unsigned char)cmdlineText[i]);
+
+    states = snapshot.states;
+    total = snapshot.total;
+    scanMilliseconds = snapshot.scanMilliseconds;
+    scanThreads = snapshot.scanThreads;
+    statFds = snapshot.statFds;
+    statFdBudget = snapshot.statFdBudget;
+    batchedReads = snapshot.batchedReads;
+}
+
+void ProcessTable::link(const ProcessTable& previous, unsigned long long previousSequence,
+                        unordered_map<int, uint32_t>& rowOfPid) {
+    rowOfPid.clear();
+    for (uint32_t row = 0; row < previous.size(); row++) rowOfPid[previous.pid[row]] = row;
+    previousRow.resize(size());
+    cmdlineChanged.resize(size());
+    for (size_t row = 0; row < size(); row++) {
+        auto it = rowOfPid.find(pid[row]);
+        if (it == rowOfPid.end()) {
+            previousRow[row] = NoRow;
+            cmdlineChanged[row] = 1;
+            continue;
+        }
+        uint32_t other = it->second;
+        size_t length = cmdlineLength(row);
+        previousRow[row] = other;
+        cmdlineChanged[row] = starttime[row] != previous.starttime[other] || length != previous.cmdlineLength(other) ||
+                              memcmp(cmdlineOf(row), previous.cmdlineOf(other), length) != 0;
+    }
+    previousScan = previousSequence;
+}
+
+void ProcessTable::topByCpu(size_t count, vector<uint32_t>& rows) const {
+    rows.resize(cpu.size());
+    for (size_t row = 0; row < rows.size(); row++) rows[row] = (uint32_t)row;
+    count = min(count, rows.size());
+    const float* column = cpu.data();
+    partial_sort(rows.begin(), rows.begin() + count, rows.end(),
+                 [column](uint32_t a, uint32_t b) { return column[a] > column[b]; });
+    rows.resize(count);
+}
+
+void ProcessTable::topByRss(size_t count, vector<uint32_t>& rows) const {
+    rows.resize(rss.size());
+    for (size_t row = 0; row < rows.size(); row++) rows[row] = (uint32_t)row;
+    count = min(count, rows.size());
+    const long long* column = rss.data();
+    partial_sort(rows.begin(), rows.begin() + count, rows.end(),
+                 [column](uint32_t a, uint32_t b) { return column[a] > column[b]; });
+    rows.resize(count);
+}
+
+namespace {
+
+// Substring search for the process filter. With SSE2 it compares the first
+// and last needle bytes against 16 candidate positions at once and only
+// checks the full needle where both agree.
+bool containsSubstring(const char* text, size_t length, const char* needle, size_t needleLength) {
+    if (needleLength == 0) return true;
+    if (needleLength > length) return false;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needleLength - 1]);
+    for (; i + needleLength + 15 <= length; i += 16) {
+        __m128i blockFirst = _mm_loadu_si128((const __m128i*)(text + i));
+        __m128i blockLast = _mm_loadu_si128((const __m128i*)(text + i + needleLength - 1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(blockFirst, first), _mm_cmpeq_epi8(blockLast, last)));
+        while (mask != 0) {
+            if (memcmp(text + i + __builtin_ctz(mask), needle, needleLength) == 0) return true;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    return memmem(text + i, length - i, needle, needleLength) != nullptr;
+}
+
+uint32_t packTrigram(const char* text) {
+    return (uint32_t)(unsigned char)text[0] << 16 | (uint32_t)(unsigned char)text[1] << 8 | (unsigned char)text[2];
+}
+
+// Orders two rows by the sort keys in turn, falling back to the PID
+struct RowLess {
+    const ProcessTable& table;
+    const vector<ProcessSortKey>& keys;
+
+    static int compare(long long a, long long b) { return (a > b) - (a < b); }
+
+    bool operator()(uint32_t a, uint32_t b) const {
+        for (const ProcessSortKey& key : keys) {
+            int order = 0;
+            switch (key.column) {
+            case ColumnPid: order = compare(table.pid[a], table.pid[b]); break;
+            case ColumnName: order = strcmp(table.nameOf(a), table.nameOf(b)); break;
+            case ColumnState: order = compare(table.state[a], table.state[b]); break;
+            case ColumnCpu: order = (table.cpu[a] > table.cpu[b]) - (table.cpu[a] < table.cpu[b]); break;
+            case ColumnMemory: order = compare(table.vsize[a], table.vsize[b]); break;
+            case ColumnCpuDelay: order = compare(table.cpuDelay[a], table.cpuDelay[b]); break;
+            case ColumnIoDelay: order = compare(table.blkioDelay[a], table.blkioDelay[b]); break;
+            case ColumnSwapDelay: order = compare(table.swapinDelay[a], table.swapinDelay[b]); break;
+            case ColumnReclaimDelay: order = compare(table.reclaimDelay[a], table.reclaimDelay[b]); break;
+            }
+            if (order != 0) return key.descending ? order > 0 : order < 0;
+        }
+        return table.pid[a] < table.pid[b];
+    }
+};
+
+}
+
+CmdlineIndex::CmdlineIndex() : deadDocuments(0), generation(0) {}
+
+void CmdlineIndex::clear() {
+    documents.clear();
+    postings.clear();
+    documentOfPid.clear();
+    rowOfDocument.clear();
+    documentOfRow.clear();
+    deadDocuments = 0;
+}
+
+void CmdlineIndex::addDocument(int pid, unsigned long long starttime, const char* text, size_t length) {
+    uint32_t id = (uint32_t)documents.size();
+    documents.push_back({pid, starttime, string(text, length), true, generation});
+    documentOfPid[pid] = id;
+
+    // Ids only grow, so appending keeps every posting list sorted
+    trigrams.clear();
+    for (size_t i = 0; i + 3 <= length; i++) trigrams.push_back(packTrigram(text + i));
+    sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(unique(trigrams.begin(), trigrams.end()), trigrams.end());
+    for (uint32_t trigram : trigrams) postings[trigram].push_back(id);
+}
+
+void CmdlineIndex::retire(uint32_t id) {
+    Document& document = documents[id];
+    document.live = false;
+    deadDocuments++;
+    auto it = documentOfPid.find(document.pid);
+    if (it != documentOfPid.end() && it->second == id) documentOfPid.erase(it);
+}
+
+void CmdlineIndex::rebuild() {
+    vector<Document> live;
+    live.reserve(documents.size() - deadDocuments);
+    for (Document& document : documents) {
+        if (document.live) live.push_back(move(document));
+    }
+    clear();
+    for (const Document& document : live) {
+        addDocument(document.pid, document.starttime, document.text.data(), document.text.size());
+    }
+}
+
+void CmdlineIndex::sync(const ProcessTable& table, bool linked) {
+    generation++;
+    if (linked) {
+        syncLinked(table);
+    } else {
+        documentOfRow.resize(table.size());
+        for (uint32_t row = 0; row < table.size(); row++) {
+            const char* text = table.cmdlineLower.data() + table.cmdlineOffset[row];
+            size_t length = table.cmdlineLength(row);
+            auto it = documentOfPid.find(table.pid[row]);
+            if (it != documentOfPid.end()) {
+                Document& document = documents[it->second];
+                if (document.starttime == table.starttime[row] && document.text.size() == length &&
+                    memcmp(document.text.data(), text, length) == 0) {
+                    document.seen = generation;
+                    documentOfRow[row] = it->second;
+                    continue;
+                }
+                // Same pid but a new process, or an exec changed the line
+                retire(it->second);
+            }
+            addDocument(table.pid[row], table.starttime[row], text, length);
+            documentOfRow[row] = (uint32_t)documents.size() - 1;
+        }
+
+        for (auto it = documentOfPid.begin(); it != documentOfPid.end();) {
+            Document& document = documents[it->second];
+            if (document.seen == generation) {
+                ++it;
+                continue;
+            }
+            document.live = false;
+            deadDocuments++;
+            it = documentOfPid.erase(it);
+        }
+    }
+
+    if (deadDocuments > documents.size() - deadDocuments) {
+        rebuild();
+        documentOfRow.resize(table.size());
+        for (uint32_t row = 0; row < table.size(); row++) documentOfRow[row] = documentOfPid[table.pid[row]];
+    }
+    rowOfDocument.assign(documents.size(), NoRow);
+    for (uint32_t row = 0; row < table.size(); row++) rowOfDocument[documentOfRow[row]] = row;
+}
+
+// Only rows the sampler marked as changed need a lookup or new trigrams
+void CmdlineIndex::syncLinked(const ProcessTable& table) {
+    vector<uint32_t>& previousDocuments = rowOfDocument; // Free until the end of sync()
+    previousDocuments.swap(documentOfRow);
+    documentOfRow.resize(table.size());
+    for (uint32_t row = 0; row < table.size(); row++) {
+        uint32_t previous = table.previousRow[row];
+        if (!table.cmdlineChanged[row]) {
+            uint32_t id = previousDocuments[previous];
+            documents[id].seen = generation;
+            documentOfRow[row] = id;
+            continue;
+        }
+        if (previous != ProcessTable::NoRow) retire(previousDocuments[previous]);
+        addDocument(table.pid[row], table.starttime[row], table.cmdlineLower.data() + table.cmdlineOffset[row],
+                    table.cmdlineLength(row));
+        documentOfRow[row] = (uint32_t)documents.size() - 1;
+    }
+    // Rows of the previous table nobody carried over have exited
+    for (uint32_t id : previousDocuments) {
+        if (documents[id].live && documents[id].seen != generation) retire(id);
+    }
+}
+
+void CmdlineIndex::query(const string& needle, vector<signed char>& matched) {
+    if (needle.size() < MinQuery) return;
+
+    // Every match contains all of the needle's trigrams, so the shortest
+    // posting list is a complete candidate set; each candidate is then verified
+    const vector<uint32_t>* candidates = nullptr;
+    for (size_t i = 0; i + 3 <= needle.size(); i++) {
+        auto it = postings.find(packTrigram(needle.data() + i));
+        if (it == postings.end()) return;
+        if (candidates == nullptr || it->second.size() < candidates->size()) candidates = &it->second;
+    }
+    for (uint32_t id : *candidates) {
+        const Document& document = documents[id];
+        if (!document.live || rowOfDocument[id] == NoRow) continue;
+        if (containsSubstring(document.text.data(), document.text.size(), needle.data(), needle.size()))
+            matched[rowOfDocument[id]] = 1;
+    }
+}
+
+ProcessView::ProcessView()
+    : filterRegex(false), filterCmdline(false), indexedSequence(0), filteredSequence(0), sequence(0), sortDirty(true),
+      filterDirty(true) {}
+
+void ProcessView::setSort(const vector<ProcessSortKey>& keys) {
+    sortKeys = keys;
+    sortDirty = true;
+}
+
+void ProcessView::setFilter(const char* text, bool useRegex, bool matchCmdline) {
+    string wanted = text;
+    if (!useRegex) {
+        for (char& c : wanted) c = (char)tolower((unsigned char)c);
+    }
+    if (wanted == filter && useRegex == filterRegex && matchCmdline == filterCmdline) return;
+    filter = wanted;
+    filterRegex = useRegex;
+    filterCmdline = matchCmdline;
+    filterDirty = true;
+
+    filterError.clear();
+    if (filterRegex && !filter.empty()) {
+        try {
+            pattern.assign(filter, regex::ECMAScript | regex::icase | regex::optimize);
+        } catch (const regex_error& error) {
+            filterError = error.what();
+        }
+    }
+}
+
+void ProcessView::update(const ProcessTable& table, unsigned long long snapshotSequence) {
+    if (snapshotSequence == sequence && !sortDirty && !filterDirty) return;
+
+    if (snapshotSequence != sequence || sortDirty) {
+        if (snapshotSequence != sequence) {
+            // Carry the previous order over to the new rows by PID; exited
+            // processes drop out and new ones are appended at the end
+            if (sequence != 0 && table.previousScan == sequence) {
+                // The sampler already matched the rows up
+                rowOfPrevious.assign(previousPids.size(), ProcessTable::NoRow);
+                for (uint32_t row = 0; row < table.size(); row++) {
+                    if (table.previousRow[row] != ProcessTable::NoRow) rowOfPrevious[table.previousRow[row]] = row;
+                }
+                merged.clear();
+                for (uint32_t previous : order) {
+                    if (rowOfPrevious[previous] != ProcessTable::NoRow) merged.push_back(rowOfPrevious[previous]);
+                }
+                for (uint32_t row = 0; row < table.size(); row++) {
+                    if (table.previousRow[row] == ProcessTable::NoRow) merged.push_back(row);
+                }
+                swap(order, merged);
+            } else {
+                rowOfPid.clear();
+                for (uint32_t row = 0; row < table.size(); row++) rowOfPid[table.pid[row]] = row;
+                order.clear();
+                for (int pid : previousPids) {
+                    auto it = rowOfPid.find(pid);
+                    if (it == rowOfPid.end()) continue;
+                    order.push_back(it->second);
+                    rowOfPid.erase(it);
+                }
+                for (uint32_t row = 0; row < table.size(); row++) {
+                    if (rowOfPid.count(table.pid[row])) order.push_back(row);
+                }
+            }
+            sequence = snapshotSequence;
+        }
+
+        sortRows(table, sortDirty);
+        sortDirty = false;
+
+        previousPids.resize(order.size());
+        for (size_t i = 0; i < order.size(); i++) previousPids[i] = table.pid[order[i]];
+    }
+
+    // The index follows every snapshot while command line matching is on,
+    // so typing never waits for it to catch up
+    if (filterCmdline && table.hasCmdlines) {
+        if (indexedSequence != sequence) {
+            cmdlineIndex.sync(table, indexedSequence != 0 && table.previousScan == indexedSequence);
+            indexedSequence = sequence;
+        }
+    } else if (indexedSequence != 0) {
+        cmdlineIndex.clear();
+        indexedSequence = 0;
+    }
+
+    filterRows(table);
+    filterDirty = false;
+}
+
+void ProcessView::filterRows(const ProcessTable& table) {
+    bool cmdlines = filterCmdline && table.hasCmdlines;
+    if (filter.empty() || !filterError.empty() || !cmdlines) filteredSequence = 0;
+    if (filter.empty()) {
+        rows = order;
+        return;
+    }
+    rows.clear();
+    if (!filterError.empty()) return;
+
+    // Many rows share a name, so each name handle is tested once per query
+    if (filterDirty) nameMatches.clear();
+    if (table.names == nullptr) return; // No scan yet, so no rows either
+    if (nameMatches.size() < table.names->size()) nameMatches.resize(table.names->size(), -1);
+
+    // A new query starts from the index when it can; a new snapshot keeps
+    // the results of rows whose command line did not change
+    if (cmdlines && (filterDirty || filteredSequence == 0 ||
+                     (filteredSequence != sequence && table.previousScan != filteredSequence))) {
+        if (!filterRegex && filter.size() >= CmdlineIndex::MinQuery) {
+            cmdlineMatches.assign(table.size(), 0);
+            cmdlineIndex.query(filter, cmdlineMatches);
+        } else {
+            cmdlineMatches.assign(table.size(), -1);
+        }
+    } else if (cmdlines && filteredSequence != sequence) {
+        carriedMatches.resize(table.size());
+        for (uint32_t row = 0; row < table.size(); row++)
+            carriedMatches[row] = table.cmdlineChanged[row] ? -1 : cmdlineMatches[table.previousRow[row]];
+        swap(cmdlineMatches, carriedMatches);
+    }
+    if (cmdlines) filteredSequence = sequence;
+
+    for (uint32_t row : order) {
+        if (matchesName(table, row) || (cmdlines && matchesCmdline(table, row))) rows.push_back(row);
+    }
+}
+
+bool ProcessView::matchesName(const ProcessTable& table, uint32_t row) {
+    uint32_t handle = table.name[row];
+    signed char& cached = nameMatches[handle];
+    if (cached < 0) {
+        if (filterRegex) {
+            cached = regex_search(table.names->name(handle), pattern);
+        } else {
+            const char* lower = table.names->lowerName(handle);
+            cached = containsSubstring(lower, strlen(lower), filter.data(), filter.size());
+        }
+    }
+    return cached != 0;
+}
+
+bool ProcessView::matchesCmdline(const ProcessTable& table, uint32_t row) {
+    signed char& cached = cmdlineMatches[row];
+    if (cached < 0) {
+        if (filterRegex) {
+            const char* text = table.cmdlineOf(row);
+            cached = regex_search(text, text + table.cmdlineLength(row), pattern);
+        } else {
+            cached = containsSubstring(table.cmdlineLower.data() + table.cmdlineOffset[row], table.cmdlineLength(row),
+                                       filter.data(), filter.size());
+        }
+    }
+    return cached != 0;
+}
+
+void ProcessView::sortRows(const ProcessTable& table, bool fullSort) {
+    RowLess less{table, sortKeys};
+    if (fullSort) {
+        sort(order.begin(), order.end(), less);
+        return;
+    }
+
+    // Keep the sorted run in place; whenever a row breaks the order, move
+    // it and its predecessor aside. k displaced rows cost
+    // O(n + k log k) instead of O(n log n).
+    misfits.clear();
+    size_t kept = 0;
+    for (uint32_t row : order) {
+        if (kept == 0 || !less(row, order[kept - 1])) {
+            order[kept++] = row;
+        } else {
+            misfits.push_back(order[--kept]);
+            misfits.push_back(row);
+        }
+    }
+    if (misfits.empty()) return;
+    if (misfits.size() > order.size() / 4) {
+        // Too much changed for the repair to pay off. The misfits go back
+        // first: the loop above already overwrote part of their slots.
+        copy(misfits.begin(), misfits.end(), order.begin() + kept);
+        sort(order.begin(), order.end(), less);
+        return;
+    }
+
+    sort(misfits.begin(), misfits.end(), less);
+    merged.resize(order.size());
+    merge(order.begin(), order.begin() + kept, misfits.begin(), misfits.end(), merged.begin(), less);
+    swap(order, merged);
+}
@@ -0,0 +1,591 @@
+#include "header.h"
+#include <cstring>
+#include <cerrno>
+
+namespace {
+
+constexpr char RecordMagic[8] = {'S', 'M', 'R', 'E', 'C', '0', '2', '\n'};
+constexpr size_t MaxRecordBytes = 256 * 1024 * 1024; // Anything larger is a corrupt length
+
+void putVarint(string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+void putSigned(string& out, long long value) { putVarint(out, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63)); }
+
+void putString(string& out, const string& text) {
+    putVarint(out, text.size());
+    out.append(text);
+}
+
+uint32_t floatBits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+float bitsFloat(uint32_t bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Bounds-checked reader over one payload; any overrun clears ok
+struct Cursor {
+    const unsigned char* position;
+    const unsigned char* end;
+    bool ok = true;
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (position == end) break;
+            unsigned char byte = *position++;
+            value |= (uint64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return value;
+        }
+        ok = false;
+        return 0;
+    }
+
+    long long signedVarint() {
+        uint64_t value = varint();
+        return (long long)(value >> 1) ^ -(long long)(value & 1);
+    }
+
+    string text() {
+        uint64_t length = varint();
+        if (length > (uint64_t)(end - position)) {
+            ok = false;
+            return string();
+        }
+        string value((const char*)position, length);
+        position += length;
+        return value;
+    }
+};
+
+// Numeric fields coded against the same field of the previous record
+struct ScalarWriter {
+    string& out;
+    vector<long long>& previous;
+    size_t slot = 0;
+
+    long long& last() {
+        if (slot == previous.size()) previous.push_back(0);
+        return previous[slot++];
+    }
+    void integer(long long value) {
+        long long& before = last();
+        putSigned(out, value - before);
+        before = value;
+    }
+    void real(float value) {
+        long long& before = last();
+        putVarint(out, floatBits(value) ^ (uint32_t)before);
+        before = floatBits(value);
+    }
+};
+
+struct ScalarReader {
+    Cursor& in;
+    vector<long long>& previous;
+    size_t slot = 0;
+
+    long long& last() {
+        if (slot == previous.size()) previous.push_back(0);
+        return previous[slot++];
+    }
+    long long integer() {
+        long long& before = last();
+        before += in.signedVarint();
+        return before;
+    }
+    float real() {
+        long long& before = last();
+        before = (uint32_t)(in.varint() ^ (uint32_t)before);
+        return bitsFloat((uint32_t)before);
+    }
+};
+
+// A string is sent only when it differs from the previous record's
+void putChangedString(string& out, string& previous, const string& value) {
+    if (value == previous) {
+        putVarint(out, 0);
+        return;
+    }
+    putVarint(out, 1);
+    putString(out, value);
+    previous = value;
+}
+
+const string& readChangedString(Cursor& in, string& previous) {
+    if (in.varint() != 0) previous = in.text();
+    return previous;
+}
+
+enum RowFlags { RowHasBase = 1, RowNameChanged = 2, RowCmdlineChanged = 4 };
+
+template<typename Stats, size_t Fields>
+void putInterfaceStats(string& out, const map<string, Stats>& current, const map<string, Stats>& previous) {
+    static_assert(sizeof(Stats) == Fields * sizeof(int), "interface stats are plain int fields");
+    putVarint(out, current.size());
+    for (const auto& [iface, stats] : current) {
+        putString(out, iface);
+        int now[Fields], before[Fields] = {};
+        memcpy(now, &stats, sizeof(now));
+        auto it = previous.find(iface);
+        if (it != previous.end()) memcpy(before, &it->second, sizeof(before));
+        for (size_t i = 0; i < Fields; i++) putSigned(out, (long long)now[i] - before[i]);
+    }
+}
+
+template<typename Stats, size_t Fields>
+void readInterfaceStats(Cursor& in, map<string, Stats>& current) {
+    map<string, Stats> decoded;
+    uint64_t count = in.varint();
+    for (uint64_t i = 0; i < count && in.ok; i++) {
+        string iface = in.text();
+        int values[Fields] = {};
+        auto it = current.find(iface);
+        if (it != current.end()) memcpy(values, &it->second, sizeof(values));
+        for (size_t field = 0; field < Fields; field++) values[field] += (int)in.signedVarint();
+        Stats stats;
+        memcpy(&stats, values, sizeof(stats));
+        decoded[iface] = stats;
+    }
+    current = move(decoded);
+}
+
+void putRates(string& out, const map<string, float>& current, const map<string, float>& previous) {
+    putVarint(out, current.size());
+    for (const auto& [iface, rate] : current) {
+        putString(out, iface);
+        auto it = previous.find(iface);
+        uint32_t before = it != previous.end() ? floatBits(it->second) : 0;
+        putVarint(out, floatBits(rate) ^ before);
+    }
+}
+
+void readRates(Cursor& in, map<string, float>& current) {
+    map<string, float> decoded;
+    uint64_t count = in.varint();
+    for (uint64_t i = 0; i < count && in.ok; i++) {
+        string iface = in.text();
+        auto it = current.find(iface);
+        uint32_t before = it != current.end() ? floatBits(it->second) : 0;
+        decoded[iface] = bitsFloat((uint32_t)in.varint() ^ before);
+    }
+    current = move(decoded);
+}
+
+bool sameShortLived(const ShortLivedProcess& a, const ShortLivedProcess& b) {
+    return a.pid == b.pid && a.ppid == b.ppid && a.exitCode == b.exitCode && a.lifetimeMs == b.lifetimeMs &&
+           a.name == b.name;
+}
+
+// Process section: its own scalars, then the rows, each against the
+// previous record's row with the same PID, then the short-lived processes
+void putProcesses(string& record, SnapshotCodecState& previous, const ProcessTable& table, vector<RecordedProcess>& rows,
+                  unordered_map<int, size_t>& rowOfPid) {
+    putChangedString(record, previous.delayStatus, table.delayStatus);
+    ScalarWriter scalars{record, previous.processScalars};
+    scalars.integer(table.total);
+    scalars.real(table.scanMilliseconds);
+    scalars.integer(table.scanThreads);
+    scalars.integer(table.eventDriven);
+    scalars.integer(table.hasDelays);
+    scalars.integer(table.hasCmdlines);
+    scalars.integer((long long)table.forkCount);
+    scalars.integer((long long)table.exitCount);
+    for (int count : table.states) scalars.integer(count);
+
+    rows.resize(table.size());
+    rowOfPid.clear();
+    putVarint(record, table.size());
+    int lastPid = 0;
+    for (size_t row = 0; row < table.size(); row++) {
+        RecordedProcess& process = rows[row];
+        process.pid = table.pid[row];
+        process.ppid = table.ppid[row];
+        process.state = table.state[row];
+        process.name = table.nameOf(row);
+        if (table.hasCmdlines) process.cmdline.assign(table.cmdlineOf(row), table.cmdlineLength(row));
+        else process.cmdline.clear();
+        process.rss = table.rss[row];
+        process.vsize = table.vsize[row];
+        process.utime = table.utime[row];
+        process.stime = table.stime[row];
+        process.starttime = table.starttime[row];
+        process.numThreads = table.numThreads[row];
+        process.cpu = table.cpu[row];
+        process.cpuDelay = table.cpuDelay[row];
+        process.blkioDelay = table.blkioDelay[row];
+        process.swapinDelay = table.swapinDelay[row];
+        process.reclaimDelay = table.reclaimDelay[row];
+        rowOfPid[process.pid] = row;
+
+        static const RecordedProcess none{};
+        auto it = previous.rowOfPid.find(process.pid);
+        const RecordedProcess& base = it != previous.rowOfPid.end() ? previous.processes[it->second] : none;
+        unsigned flags = it != previous.rowOfPid.end() ? RowHasBase : 0;
+        if (process.name != base.name) flags |= RowNameChanged;
+        if (process.cmdline != base.cmdline) flags |= RowCmdlineChanged;
+
+        putSigned(record, (long long)process.pid - lastPid);
+        lastPid = process.pid;
+        putVarint(record, flags);
+        putSigned(record, (long long)process.ppid - base.ppid);
+        putSigned(record, (long long)process.state - base.state);
+        putSigned(record, process.rss - base.rss);
+        putSigned(record, process.vsize - base.vsize);
+        putSigned(record, process.utime - base.utime);
+        putSigned(record, process.stime - base.stime);
+        putSigned(record, (long long)(process.starttime - base.starttime));
+        putSigned(record, (long long)process.numThreads - base.numThreads);
+        putVarint(record, floatBits(process.cpu) ^ floatBits(base.cpu));
+        putSigned(record, (long long)(process.cpuDelay - base.cpuDelay));
+        putSigned(record, (long long)(process.blkioDelay - base.blkioDelay));
+        putSigned(record, (long long)(process.swapinDelay - base.swapinDelay));
+        putSigned(record, (long long)(process.reclaimDelay - base.reclaimDelay));
+        if (flags & RowNameChanged) putString(record, process.name);
+        if (flags & RowCmdlineChanged) putString(record, process.cmdline);
+    }
+    swap(rows, previous.processes);
+    swap(rowOfPid, previous.rowOfPid);
+
+    // Short-lived processes only ever gain entries at the front, so send
+    // the new ones and how many of the old ones are kept
+    const vector<ShortLivedProcess>& shortLived = table.shortLived;
+    size_t added = shortLived.size();
+    for (size_t skip = 0; skip <= shortLived.size(); skip++) {
+        size_t kept = shortLived.size() - skip;
+        if (kept > previous.shortLived.size()) continue;
+        bool matches = true;
+        for (size_t i = 0; i < kept && matches; i++) matches = sameShortLived(shortLived[skip + i], previous.shortLived[i]);
+        if (matches) {
+            added = skip;
+            break;
+        }
+    }
+    putVarint(record, added);
+    putVarint(record, shortLived.size() - added);
+    for (size_t i = 0; i < added; i++) {
+        const ShortLivedProcess& process = shortLived[i];
+        putSigned(record, process.pid);
+        putSigned(record, process.ppid);
+        putString(record, process.name);
+        putVarint(record, floatBits(process.lifetimeMs));
+        putSigned(record, process.exitCode);
+    }
+    previous.shortLived = shortLived;
+}
+
+void readProcesses(Cursor& in, size_t payloadSize, SnapshotCodecState& previous, ProcessTable& table,
+                   ProcessSnapshot& processes) {
+    table.delayStatus = readChangedString(in, previous.delayStatus);
+    ScalarReader scalars{in, previous.processScalars};
+    processes.total = (int)scalars.integer();
+    processes.scanMilliseconds = scalars.real();
+    processes.scanThreads = (int)scalars.integer();
+    table.eventDriven = scalars.integer() != 0;
+    table.hasDelays = scalars.integer() != 0;
+    table.hasCmdlines = scalars.integer() != 0;
+    table.forkCount = (unsigned long long)scalars.integer();
+    table.exitCount = (unsigned long long)scalars.integer();
+    for (int& count : processes.states) count = (int)scalars.integer();
+
+    uint64_t rowCount = in.varint();
+    if (rowCount > payloadSize) in.ok = false; // Every row takes at least one byte
+    vector<RecordedProcess> rows(in.ok ? rowCount : 0);
+    unordered_map<int, size_t> rowOfPid;
+    int lastPid = 0;
+    for (size_t row = 0; row < rows.size() && in.ok; row++) {
+        RecordedProcess& process = rows[row];
+        process.pid = lastPid + (int)in.signedVarint();
+        lastPid = process.pid;
+        unsigned flags = (unsigned)in.varint();
+
+        static const RecordedProcess none{};
+        auto it = previous.rowOfPid.find(process.pid);
+        const RecordedProcess& base =
+            (flags & RowHasBase) && it != previous.rowOfPid.end() ? previous.processes[it->second] : none;
+        process.ppid = base.ppid + (int)in.signedVarint();
+        process.state = (char)(base.state + in.signedVarint());
+        process.rss = base.rss + in.signedVarint();
+        process.vsize = base.vsize + in.signedVarint();
+        process.utime = base.utime + in.signedVarint();
+        process.stime = base.stime + in.signedVarint();
+        process.starttime = base.starttime + (unsigned long long)in.signedVarint();
+        process.numThreads = base.numThreads + (int)in.signedVarint();
+        process.cpu = bitsFloat((uint32_t)in.varint() ^ floatBits(base.cpu));
+        process.cpuDelay = base.cpuDelay + (unsigned long long)in.signedVarint();
+        process.blkioDelay = base.blkioDelay + (unsigned long long)in.signedVarint();
+        process.swapinDelay = base.swapinDelay + (unsigned long long)in.signedVarint();
+        process.reclaimDelay = base.reclaimDelay + (unsigned long long)in.signedVarint();
+        process.name = flags & RowNameChanged ? in.text() : base.name;
+        process.cmdline = flags & RowCmdlineChanged ? in.text() : base.cmdline;
+        rowOfPid[process.pid] = row;
+    }
+    swap(rows, previous.processes);
+    swap(rowOfPid, previous.rowOfPid);
+
+    processes.list.resize(previous.processes.size());
+    for (size_t row = 0; row < previous.processes.size(); row++) {
+        const RecordedProcess& recorded = previous.processes[row];
+        Proc& process = processes.list[row];
+        process = Proc{};
+        process.pid = recorded.pid;
+        process.ppid = recorded.ppid;
+        process.state = recorded.state;
+        process.name = recorded.name;
+        process.cmdline = recorded.cmdline;
+        process.rss = recorded.rss;
+        process.vsize = recorded.vsize;
+        process.utime = recorded.utime;
+        process.stime = recorded.stime;
+        process.starttime = recorded.starttime;
+        process.numThreads = recorded.numThreads;
+        process.cpuUsage = recorded.cpu;
+        process.cpuDelay = recorded.cpuDelay;
+        process.blkioDelay = recorded.blkioDelay;
+        process.swapinDelay = recorded.swapinDelay;
+        process.reclaimDelay = recorded.reclaimDelay;
+    }
+
+    uint64_t added = in.varint();
+    uint64_t kept = in.varint();
+    if (added > payloadSize || kept > previous.shortLived.size()) in.ok = false;
+    vector<ShortLivedProcess> shortLived;
+    for (uint64_t i = 0; i < added && in.ok; i++) {
+        ShortLivedProcess process;
+        process.pid = (int)in.signedVarint();
+        process.ppid = (int)in.signedVarint();
+        process.name = in.text();
+        process.lifetimeMs = bitsFloat((uint32_t)in.varint());
+        process.exitCode = (int)in.signedVarint();
+        shortLived.push_back(move(process));
+    }
+    if (in.ok) shortLived.insert(shortLived.end(), previous.shortLived.begin(), previous.shortLived.begin() + kept);
+    previous.shortLived = shortLived;
+    table.shortLived = move(shortLived);
+}
+
+}
+
+SnapshotRecorder::~SnapshotRecorder() { close(); }
+
+bool SnapshotRecorder::open(const string& path) {
+    close();
+    file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        status = "Cannot write " + path + ": " + strerror(errno);
+        return false;
+    }
+    double startTime = chrono::duration<double>(chrono::system_clock::now().time_since_epoch()).count();
+    fwrite(RecordMagic, 1, sizeof(RecordMagic), file);
+    fwrite(&startTime, 1, sizeof(startTime), file);
+    previous = SnapshotCodecState();
+    status = "Recording to " + path;
+    return true;
+}
+
+void SnapshotRecorder::close() {
+    if (file != nullptr) fclose(file);
+    file = nullptr;
+    status = "Closed";
+}
+
+void SnapshotRecorder::write(const SystemSnapshot& snapshot) {
+    if (file == nullptr) return;
+    record.clear();
+    putVarint(record, (uint64_t)llround(snapshot.timestamp * 1000.0));
+
+    // Collectors that ran this round. The process section is only sent when
+    // its collector did; the other sections are small enough to always send.
+    unsigned collected = 0;
+    for (size_t c = 0; c < CollectorCount; c++) {
+        if (snapshot.collected[c] == snapshot.sequence) collected |= 1u << c;
+    }
+    putVarint(record, collected);
+
+    putChangedString(record, previous.username, snapshot.username);
+    putChangedString(record, previous.hostname, snapshot.hostname);
+    putChangedString(record, previous.cpuInfo, snapshot.cpuInfo);
+
+    ScalarWriter scalars{record, previous.scalars};
+    scalars.integer(snapshot.memInfo.total_ram);
+    scalars.integer(snapshot.memInfo.used_ram);
+    scalars.integer(snapshot.memInfo.total_swap);
+    scalars.integer(snapshot.memInfo.used_swap);
+    scalars.real(snapshot.memInfo.ram_percent);
+    scalars.real(snapshot.memInfo.swap_percent);
+    scalars.integer(snapshot.diskInfo.total_space);
+    scalars.integer(snapshot.diskInfo.used_space);
+    scalars.real(snapshot.diskInfo.usage_percent);
+    scalars.real(snapshot.cpuUsage);
+    scalars.real(snapshot.temperature);
+    scalars.real(snapshot.fanSpeed);
+
+    if (collected & (1u << CollectorProcesses)) putProcesses(record, previous, *snapshot.processes, rows, rowOfPid);
+
+    vector<pair<string, string>> addresses;
+    for (const IP4& ip : snapshot.interfaces.ip4s) addresses.emplace_back(ip.name, ip.addressBuffer);
+    if (addresses == previous.addresses) {
+        putVarint(record, 0);
+    } else {
+        putVarint(record, addresses.size() + 1);
+        for (const auto& [name, address] : addresses) {
+            putString(record, name);
+            putString(record, address);
+        }
+        previous.addresses = move(addresses);
+    }
+
+    putInterfaceStats<RX, 8>(record, snapshot.rx, previous.rx);
+    putInterfaceStats<TX, 8>(record, snapshot.tx, previous.tx);
+    putRates(record, snapshot.rxRate, previous.rxRate);
+    putRates(record, snapshot.txRate, previous.txRate);
+    previous.rx = snapshot.rx;
+    previous.tx = snapshot.tx;
+    previous.rxRate = snapshot.rxRate;
+    previous.txRate = snapshot.txRate;
+
+    // Flushed per record so an interrupted recording is still readable
+    string length;
+    putVarint(length, record.size());
+    if (fwrite(length.data(), 1, length.size(), file) != length.size() ||
+        fwrite(record.data(), 1, record.size(), file) != record.size() || fflush(file) != 0) {
+        status = string("Recording stopped: ") + strerror(errno);
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+SnapshotReplay::~SnapshotReplay() { close(); }
+
+bool SnapshotReplay::open(const string& path) {
+    close();
+    file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        status = "Cannot read " + path + ": " + strerror(errno);
+        return false;
+    }
+    char magic[sizeof(RecordMagic)];
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, RecordMagic, sizeof(magic)) != 0 ||
+        fread(&startTime, 1, sizeof(startTime), file) != sizeof(startTime)) {
+        close();
+        status = path + " is not a recording";
+        return false;
+    }
+    previous = SnapshotCodecState();
+    hasNext = readRecord(next);
+    status = "Replaying " + path;
+    return true;
+}
+
+void SnapshotReplay::close() {
+    if (file != nullptr) fclose(file);
+    file = nullptr;
+    hasNext = false;
+    status = "Closed";
+}
+
+bool SnapshotReplay::readRecord(string& out) {
+    uint64_t length = 0;
+    for (int shift = 0;; shift += 7) {
+        int byte = fgetc(file);
+        if (byte == EOF || shift > 63) return false;
+        length |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) break;
+    }
+    if (length > MaxRecordBytes) return false;
+    out.resize(length);
+    return fread(&out[0], 1, length, file) == length; // A cut-off last record ends the replay
+}
+
+float SnapshotReplay::nextTimestamp() const {
+    if (!hasNext) return 0.0f;
+    Cursor in{(const unsigned char*)next.data(), (const unsigned char*)next.data() + next.size()};
+    return in.varint() / 1000.0f;
+}
+
+void SnapshotReplay::nextCollected(array<bool, CollectorCount>& collected) const {
+    collected.fill(false);
+    if (!hasNext) return;
+    Cursor in{(const unsigned char*)next.data(), (const unsigned char*)next.data() + next.size()};
+    in.varint();
+    unsigned mask = (unsigned)in.varint();
+    for (size_t c = 0; c < CollectorCount; c++) collected[c] = (mask >> c) & 1;
+}
+
+bool SnapshotReplay::read(SystemSnapshot& snapshot, ProcessTable* table, ProcessSnapshot& processes) {
+    if (!hasNext) return false;
+    swap(payload, next);
+    hasNext = readRecord(next);
+
+    Cursor in{(const unsigned char*)payload.data(), (const unsigned char*)payload.data() + payload.size()};
+    snapshot.timestamp = in.varint() / 1000.0f;
+    unsigned collected = (unsigned)in.varint();
+
+    snapshot.username = readChangedString(in, previous.username);
+    snapshot.hostname = readChangedString(in, previous.hostname);
+    snapshot.cpuInfo = readChangedString(in, previous.cpuInfo);
+
+    ScalarReader scalars{in, previous.scalars};
+    snapshot.memInfo.total_ram = scalars.integer();
+    snapshot.memInfo.used_ram = scalars.integer();
+    snapshot.memInfo.total_swap = scalars.integer();
+    snapshot.memInfo.used_swap = scalars.integer();
+    snapshot.memInfo.ram_percent = scalars.real();
+    snapshot.memInfo.swap_percent = scalars.real();
+    snapshot.diskInfo.total_space = scalars.integer();
+    snapshot.diskInfo.used_space = scalars.integer();
+    snapshot.diskInfo.usage_percent = scalars.real();
+    snapshot.cpuUsage = scalars.real();
+    snapshot.temperature = scalars.real();
+    snapshot.fanSpeed = scalars.real();
+
+    // The caller asked for a table exactly when nextCollected() said the
+    // section is there; a mismatch means the file changed under us
+    if (((collected >> CollectorProcesses) & 1) != (table != nullptr)) in.ok = false;
+    if (table != nullptr && in.ok) readProcesses(in, payload.size(), previous, *table, processes);
+
+    uint64_t addressCount = in.varint();
+    if (addressCount > payload.size()) in.ok = false;
+    if (addressCount > 0 && in.ok) {
+        previous.addresses.clear();
+        for (uint64_t i = 0; i + 1 < addressCount && in.ok; i++) {
+            string name = in.text();
+            previous.addresses.emplace_back(name, in.text());
+        }
+    }
+    Networks interfaces;
+    for (const auto& [name, address] : previous.addresses) {
+        IP4 ip;
+        ip.name = strdup(name.c_str());
+        snprintf(ip.addressBuffer, sizeof(ip.addressBuffer), "%s", address.c_str());
+        interfaces.ip4s.push_back(ip);
+    }
+    snapshot.interfaces = move(interfaces);
+
+    readInterfaceStats<RX, 8>(in, previous.rx);
+    readInterfaceStats<TX, 8>(in, previous.tx);
+    readRates(in, previous.rxRate);
+    readRates(in, previous.txRate);
+    snapshot.rx = previous.rx;
+    snapshot.tx = previous.tx;
+    snapshot.rxRate = previous.rxRate;
+    snapshot.txRate = previous.txRate;
+
+    if (!in.ok) {
+        status = "Recording is corrupt; replay stopped";
+        hasNext = false;
+        return false;
+    }
+    return true;
+}
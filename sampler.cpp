@@ -0,0 +1,405 @@
+#include "header.h"
+#include <algorithm>
+
+// Store series behind each rollup
+static const char* const historySeries[HistoryMetricCount] = {"cpu", "temperature", "fan", "rx", "tx"};
+
+SystemSampler::SystemSampler()
+    : running(false), sequence(0),
+      scanThreads((int)min(4u, max(1u, thread::hardware_concurrency() / 2))), statFdBudget(0), batchReads(false),
+      eventTracking(false),
+      delayAccounting(false), taskstatsAttempted(false), collectCmdlines(false), cmdlineGeneration(0),
+      historySpan(600.0f), replaySpeed(1.0f), replayDone(false) {
+    for (size_t metric = 0; metric < HistoryMetricCount; metric++) rollups[metric] = &ownRollups[metric];
+}
+
+SystemSampler::~SystemSampler() { stop(); }
+
+void SystemSampler::start() {
+    if (running.exchange(true)) return;
+    worker = thread(&SystemSampler::run, this);
+}
+
+void SystemSampler::stop() {
+    if (!running.exchange(false)) return;
+    scheduler.wake();
+    if (worker.joinable()) worker.join();
+}
+
+bool SystemSampler::poll() { return buffers.update(); }
+
+const SystemSnapshot& SystemSampler::current() const { return buffers.read(); }
+
+void SystemSampler::setInterval(float seconds) {
+    for (size_t c = 0; c < CollectorCount; c++) {
+        scheduler.setPeriod((Collector)c, seconds);
+        scheduler.setPhase((Collector)c, 0.0f);
+    }
+}
+
+void SystemSampler::setPeriod(Collector collector, float seconds) { scheduler.setPeriod(collector, seconds); }
+
+float SystemSampler::getPeriod(Collector collector) const { return scheduler.getPeriod(collector); }
+
+void SystemSampler::setPhase(Collector collector, float seconds) { scheduler.setPhase(collector, seconds); }
+
+float SystemSampler::getPhase(Collector collector) const { return scheduler.getPhase(collector); }
+
+void SystemSampler::setScanThreads(int threads) { scanThreads.store(max(1, threads)); }
+
+int SystemSampler::getScanThreads() const { return scanThreads.load(); }
+
+void SystemSampler::setStatFdBudget(size_t fds) { statFdBudget.store(min(fds, ProcessScanner::statFdLimit())); }
+
+size_t SystemSampler::getStatFdBudget() const { return statFdBudget.load(); }
+
+void SystemSampler::setBatchReads(bool enabled) { batchReads.store(enabled); }
+
+bool SystemSampler::getBatchReads() const { return batchReads.load(); }
+
+void SystemSampler::setEventTracking(bool enabled) { eventTracking.store(enabled); }
+
+bool SystemSampler::getEventTracking() const { return eventTracking.load(); }
+
+void SystemSampler::setDelayAccounting(bool enabled) { delayAccounting.store(enabled); }
+
+bool SystemSampler::getDelayAccounting() const { return delayAccounting.load(); }
+
+void SystemSampler::setCollectCmdlines(bool enabled) { collectCmdlines.store(enabled); }
+
+bool SystemSampler::getCollectCmdlines() const { return collectCmdlines.load(); }
+
+void SystemSampler::setHistorySpan(float seconds) { historySpan.store(max(seconds, 1.0f)); }
+
+float SystemSampler::getHistorySpan() const { return historySpan.load(); }
+
+bool SystemSampler::recordTo(const string& path) { return recorder.open(path); }
+
+bool SystemSampler::replayFrom(const string& path, float speed) {
+    replaySpeed = max(speed, 0.01f);
+    return replay.open(path);
+}
+
+const string& SystemSampler::getSourceStatus() const {
+    return replay.isOpen() ? replay.getStatus() : recorder.getStatus();
+}
+
+void SystemSampler::setPublishCallback(function<void()> callback) { publishCallback = move(callback); }
+
+void SystemSampler::restoreHistory() {
+    if (!historyStore.open(getHostname())) return;
+    // Mapped rollups already hold the earlier runs; only without them are
+    // the segments decoded
+    double now = chrono::duration<double>(chrono::system_clock::now().time_since_epoch()).count();
+    double since = now - RollupSeries::TierSeconds[RollupSeries::TierCount - 1] * RollupSeries::BucketCount;
+    for (size_t metric = 0; metric < HistoryMetricCount; metric++) {
+        rollups[metric] = historyStore.mapRollups(historySeries[metric]);
+        if (rollups[metric] != nullptr) continue;
+        RollupSeries& rollup = ownRollups[metric];
+        rollups[metric] = &rollup;
+        historyStore.load(historySeries[metric], since, [&rollup](double time, float value) { rollup.add(time, value); });
+    }
+}
+
+// Only what was collected this time is stored, so series keep their own cadence
+void SystemSampler::recordHistory(const SystemSnapshot& snapshot, double time, const array<bool, CollectorCount>& due,
+                                  float rxTotal, float txTotal) {
+    if (!historyStore.isOpen()) return;
+    if (due[CollectorCpu]) historyStore.append(historySeries[HistoryCpu], time, snapshot.cpuUsage);
+    if (due[CollectorSensors]) {
+        historyStore.append(historySeries[HistoryTemperature], time, snapshot.temperature);
+        historyStore.append(historySeries[HistoryFan], time, snapshot.fanSpeed);
+    }
+    if (due[CollectorMemory]) {
+        historyStore.append("memory", time, snapshot.memInfo.ram_percent);
+        historyStore.append("swap", time, snapshot.memInfo.swap_percent);
+    }
+    if (due[CollectorDisk]) historyStore.append("disk", time, snapshot.diskInfo.usage_percent);
+    if (due[CollectorNetwork]) {
+        historyStore.append(historySeries[HistoryRx], time, rxTotal);
+        historyStore.append(historySeries[HistoryTx], time, txTotal);
+        for (const auto& [iface, rate] : snapshot.rxRate) historyStore.append("rx." + iface, time, rate);
+        for (const auto& [iface, rate] : snapshot.txRate) historyStore.append("tx." + iface, time, rate);
+    }
+}
+
+void SystemSampler::run() {
+    // Earlier runs' history goes into the rollups before the first snapshot;
+    // a replay builds its own from the recording instead
+    if (!replay.isOpen()) restoreHistory();
+
+    scheduler.start();
+    array<bool, CollectorCount> due;
+    array<long long, CollectorCount> ticks;
+    while (running.load()) {
+        SystemSnapshot& snapshot = buffers.writeBuffer();
+        if (replay.isOpen()) {
+            // Publish each record, then wait for the recorded gap to the next one
+            bool read = collectReplay(snapshot);
+            float wait = scheduler.getPeriod(CollectorCpu);
+            if (read && !replay.finished()) wait = max(replay.nextTimestamp() - snapshot.timestamp, 0.0f) / replaySpeed;
+            if (read) buffers.publish();
+            if (replay.finished()) replayDone.store(true);
+            if (read && publishCallback) publishCallback();
+            // Only stop() cuts the gap short; a cadence change has no say here
+            long long deadline = CollectorScheduler::now() + (long long)(wait * 1e9);
+            while (!scheduler.sleepUntil(deadline) && running.load()) {}
+            continue;
+        }
+        // Returns early on stop() or a cadence change
+        if (!scheduler.wait(due, ticks)) continue;
+        collect(snapshot, due, ticks);
+        buffers.publish();
+        if (publishCallback) publishCallback();
+    }
+}
+
+// Copies one collector's part of a snapshot
+static void copyCollected(Collector collector, const SystemSnapshot& from, SystemSnapshot& to) {
+    switch (collector) {
+    case CollectorCpu:
+        to.cpuUsage = from.cpuUsage;
+        break;
+    case CollectorProcesses:
+        to.processes = from.processes; // Shared, not copied
+        break;
+    case CollectorMemory:
+        to.memInfo = from.memInfo;
+        break;
+    case CollectorDisk:
+        to.diskInfo = from.diskInfo;
+        break;
+    case CollectorNetwork:
+        to.interfaces = from.interfaces;
+        to.rx = from.rx;
+        to.tx = from.tx;
+        to.rxRate = from.rxRate;
+        to.txRate = from.txRate;
+        break;
+    case CollectorSensors:
+        to.temperature = from.temperature;
+        to.fanSpeed = from.fanSpeed;
+        break;
+    case CollectorCount:
+        break;
+    }
+    to.collected[collector] = from.collected[collector];
+}
+
+void SystemSampler::collect(SystemSnapshot& snapshot, const array<bool, CollectorCount>& due,
+                            const array<long long, CollectorCount>& ticks) {
+    // Seconds since the scheduler started, at a collector's tick
+    auto secondsAt = [this](long long tick) { return (float)((tick - scheduler.getStartTime()) / 1e9); };
+    long long firstTick = LLONG_MAX;
+    for (size_t c = 0; c < CollectorCount; c++) {
+        if (due[c]) firstTick = min(firstTick, ticks[c]);
+    }
+    snapshot.sequence = ++sequence;
+    snapshot.timestamp = secondsAt(firstTick);
+
+    // This buffer is older than the last published one; bring the parts
+    // that are not collected now up to date from there
+    const SystemSnapshot& previous = buffers.published();
+    for (size_t c = 0; c < CollectorCount; c++) {
+        if (!due[c] && &previous != &snapshot && snapshot.collected[c] != previous.collected[c])
+            copyCollected((Collector)c, previous, snapshot);
+    }
+
+    snapshot.username = getCurrentUsername();
+    snapshot.hostname = getHostname();
+    if (snapshot.cpuInfo.empty()) snapshot.cpuInfo = CPUinfo();
+
+    if (due[CollectorCpu]) snapshot.cpuUsage = cpuTracker.calculateCPUUsage();
+    if (due[CollectorSensors]) {
+        snapshot.temperature = getCPUTemperature();
+        snapshot.fanSpeed = getFanSpeed();
+    }
+    if (due[CollectorMemory]) snapshot.memInfo = resourceTracker.getMemoryInfo();
+    if (due[CollectorDisk]) snapshot.diskInfo = resourceTracker.getDiskInfo();
+    if (due[CollectorProcesses]) collectProcesses(snapshot, due[CollectorCpu]);
+    if (due[CollectorNetwork]) {
+        snapshot.interfaces = networkTracker.getNetworkInterfaces();
+        networkTracker.getNetworkStats(snapshot.rx, snapshot.tx);
+        rateTracker.update(snapshot.rx, snapshot.tx, secondsAt(ticks[CollectorNetwork]));
+        snapshot.rxRate = rateTracker.rxRate;
+        snapshot.txRate = rateTracker.txRate;
+    }
+    for (size_t c = 0; c < CollectorCount; c++) {
+        if (due[c]) snapshot.collected[c] = snapshot.sequence;
+    }
+
+    // Rollups use wall-clock time so buckets line up with the clock
+    snapshot.wallTime = chrono::duration<double>(chrono::system_clock::now().time_since_epoch()).count();
+    float rxTotal, txTotal;
+    updateHistory(snapshot, snapshot.wallTime, due, rxTotal, txTotal);
+    recordHistory(snapshot, snapshot.wallTime, due, rxTotal, txTotal);
+    snapshot.historyStatus = historyStore.getStatus();
+
+    if (recorder.isOpen()) recorder.write(snapshot);
+}
+
+// cpuRead: the CPU collector read /proc/stat in this same round
+// A table for this snapshot to fill. Published tables are never written
+// again, so one is only reused after every snapshot has let go of it; with
+// three buffer slots that takes at most three tables.
+ProcessTable& SystemSampler::nextProcessTable(SystemSnapshot& snapshot) {
+    snapshot.processes.reset();
+    for (auto& table : processTables) {
+        if (table.use_count() != 1) continue;
+        snapshot.processes = table;
+        return *table;
+    }
+    processTables.push_back(make_shared<ProcessTable>());
+    snapshot.processes = processTables.back();
+    return *processTables.back();
+}
+
+void SystemSampler::collectProcesses(SystemSnapshot& snapshot, bool cpuRead) {
+    // One /proc walk gives the table, the state histogram and the total
+    processScanner.setThreadCount(scanThreads.load());
+    processScanner.setStatFdBudget(statFdBudget.load());
+    processScanner.setBatchReads(batchReads.load());
+    if (eventTracking.load() != procEvents.isActive()) {
+        if (eventTracking.load()) procEvents.start(); // Stays in polling mode if this fails
+        else procEvents.stop();
+    }
+    // The last published scan, kept alive while the new table is linked to it
+    shared_ptr<const ProcessTable> previous = buffers.published().processes;
+    unsigned long long previousSequence = buffers.published().collected[CollectorProcesses];
+    ProcessTable& processes = nextProcessTable(snapshot);
+    processes.eventDriven = procEvents.isActive() && procEvents.copyLivePids(livePids);
+    if (processes.eventDriven) {
+        processScanner.scan(scanned, livePids);
+        procEvents.acknowledge(livePids, scanned.list);
+    } else {
+        processScanner.scan(scanned);
+        if (procEvents.isActive()) procEvents.reseed(scanned.list);
+    }
+    if (procEvents.isActive()) {
+        // Keep the most recent short-lived processes, newest first
+        constexpr size_t MaxShortLived = 100;
+        size_t before = shortLived.size();
+        procEvents.takeExited(shortLived);
+        reverse(shortLived.begin() + before, shortLived.end());
+        rotate(shortLived.begin(), shortLived.begin() + before, shortLived.end());
+        if (shortLived.size() > MaxShortLived) shortLived.resize(MaxShortLived);
+        processes.forkCount = procEvents.getForkCount();
+        processes.exitCount = procEvents.getExitCount();
+    }
+    processes.shortLived = shortLived;
+    processes.readStatus = processScanner.getReadStatus();
+
+    // Delay columns, when taskstats is usable; a failed open() is only
+    // retried after the option is switched off and on again
+    if (!delayAccounting.load()) {
+        taskstats.close();
+        taskstatsAttempted = false;
+        processes.delayStatus = "Disabled";
+    } else {
+        if (!taskstatsAttempted) taskstats.open();
+        taskstatsAttempted = true;
+        processes.delayStatus = taskstats.getStatus();
+    }
+    processes.hasDelays = taskstats.isAvailable();
+    if (processes.hasDelays) {
+        // One netlink round trip per process adds up on large hosts, so each
+        // scan gets a share of the process period; rows past it keep their
+        // last totals
+        constexpr float DelayBudgetShare = 0.05f;
+        float budgetMs = scheduler.getPeriod(CollectorProcesses) * 1000.0f * DelayBudgetShare;
+        size_t refreshed = taskstats.queryAll(scanned.list, budgetMs);
+        if (refreshed < scanned.list.size())
+            processes.delayStatus += " (" + to_string(refreshed) + " of " + to_string(scanned.list.size()) + " refreshed)";
+    }
+    processes.hasCmdlines = collectCmdlines.load();
+    if (processes.hasCmdlines) {
+        cmdlineGeneration++;
+        for (auto& proc : scanned.list) {
+            CachedCmdline& cached = cmdlineCache[proc.pid];
+            // exec keeps the pid and start time but normally changes the name.
+            // An empty line from a user process may mean exec had not finished
+            // setting it up yet, so it is read once more on the next scan. Kernel
+            // threads (PF_KTHREAD) and zombies really have none, and some
+            // processes clear theirs; after the retry it is kept as it is.
+            constexpr unsigned KernelThreadFlag = 0x00200000;
+            bool changed = cached.generation == 0 || cached.starttime != proc.starttime || cached.name != proc.name;
+            bool retry = !changed && !cached.settled && cached.text.empty();
+            if (changed || retry) {
+                cached.starttime = proc.starttime;
+                cached.name = proc.name;
+                readProcessCmdline(processScanner.getProcFd(), proc.pid, cached.text);
+                cached.settled = retry || (proc.flags & KernelThreadFlag) || proc.state == 'Z' || proc.state == 'X';
+            }
+            cached.generation = cmdlineGeneration;
+            proc.cmdline = cached.text; // Copied once, into the table's arena
+        }
+        for (auto it = cmdlineCache.begin(); it != cmdlineCache.end();) {
+            if (it->second.generation != cmdlineGeneration) it = cmdlineCache.erase(it);
+            else ++it;
+        }
+    } else {
+        cmdlineCache.clear();
+    }
+
+    // The system total has to come from the same moment as the scan
+    long long totalTime = cpuRead ? cpuTracker.getTotalTime() : cpuTracker.readTotalTime();
+    processTracker.update(scanned, totalTime);
+    for (auto& proc : scanned.list) proc.cpuUsage = processTracker.getCPUUsage(proc.pid);
+
+    // Publish as columns; the UI never sees the scanner's row objects
+    processes.assign(scanned, processNames);
+    processes.link(*previous, previousSequence, previousRowOfPid);
+}
+
+bool SystemSampler::collectReplay(SystemSnapshot& snapshot) {
+    if (replay.finished()) return false;
+    // Only records where the process collector ran carry a process table;
+    // the others keep showing the last one, as they did when recorded
+    array<bool, CollectorCount> due;
+    replay.nextCollected(due);
+    const SystemSnapshot& published = buffers.published();
+    shared_ptr<const ProcessTable> previous = published.processes;
+    unsigned long long previousSequence = published.collected[CollectorProcesses];
+    ProcessTable* table = due[CollectorProcesses] ? &nextProcessTable(snapshot) : nullptr;
+    if (!replay.read(snapshot, table, scanned)) return false;
+    snapshot.sequence = ++sequence;
+    if (table != nullptr) {
+        table->assign(scanned, processNames);
+        table->link(*previous, previousSequence, previousRowOfPid);
+    } else {
+        snapshot.processes = previous;
+    }
+
+    snapshot.wallTime = replay.getStartTime() + snapshot.timestamp;
+    for (size_t c = 0; c < CollectorCount; c++)
+        snapshot.collected[c] = due[c] ? snapshot.sequence : published.collected[c];
+    float rxTotal, txTotal;
+    updateHistory(snapshot, snapshot.wallTime, due, rxTotal, txTotal);
+    snapshot.historyStatus = replay.getStatus();
+    return true;
+}
+
+// Network totals leave out loopback, like the Network Usage view. Rollups
+// only take samples from collectors that ran.
+void SystemSampler::updateHistory(SystemSnapshot& snapshot, double time, const array<bool, CollectorCount>& due,
+                                  float& rxTotal, float& txTotal) {
+    rxTotal = 0.0f;
+    txTotal = 0.0f;
+    for (const auto& [iface, rate] : snapshot.rxRate) {
+        if (iface != "lo") rxTotal += rate;
+    }
+    for (const auto& [iface, rate] : snapshot.txRate) {
+        if (iface != "lo") txTotal += rate;
+    }
+    if (due[CollectorCpu]) rollups[HistoryCpu]->add(time, snapshot.cpuUsage);
+    if (due[CollectorSensors]) {
+        rollups[HistoryTemperature]->add(time, snapshot.temperature);
+        rollups[HistoryFan]->add(time, snapshot.fanSpeed);
+    }
+    if (due[CollectorNetwork]) {
+        rollups[HistoryRx]->add(time, rxTotal);
+        rollups[HistoryTx]->add(time, txTotal);
+    }
+    double span = historySpan.load();
+    for (size_t metric = 0; metric < HistoryMetricCount; metric++) rollups[metric]->plot(span, snapshot.history[metric]);
+}
@@ -0,0 +1,130 @@
+#include "header.h"
+#include <cerrno>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+const char* const CollectorScheduler::Names[CollectorCount] = {"CPU", "Processes", "Memory", "Disk", "Network", "Sensors"};
+
+namespace {
+
+constexpr long long NanosPerSecond = 1000000000LL;
+constexpr long long MinPeriod = 10000000LL; // 10 ms
+
+// Defaults: the process table is the expensive one and sensors barely move
+constexpr float DefaultPeriods[CollectorCount] = {0.25f, 1.0f, 0.5f, 2.0f, 0.5f, 2.0f};
+
+long long toNanos(float seconds) { return (long long)((double)seconds * NanosPerSecond); }
+
+float toSeconds(long long nanos) { return (float)((double)nanos / NanosPerSecond); }
+
+}
+
+long long CollectorScheduler::now() {
+    timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * NanosPerSecond + time.tv_nsec;
+}
+
+CollectorScheduler::CollectorScheduler()
+    : startTime(now()), timerFd(timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)),
+      wakeFd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) {
+    for (size_t c = 0; c < CollectorCount; c++) {
+        periods[c].store(toNanos(DefaultPeriods[c]));
+        phases[c].store(0);
+        appliedPeriods[c] = appliedPhases[c] = nextTicks[c] = 0;
+    }
+}
+
+CollectorScheduler::~CollectorScheduler() {
+    if (timerFd >= 0) close(timerFd);
+    if (wakeFd >= 0) close(wakeFd);
+}
+
+void CollectorScheduler::setPeriod(Collector collector, float seconds) {
+    periods[collector].store(max(toNanos(seconds), MinPeriod));
+    wake();
+}
+
+float CollectorScheduler::getPeriod(Collector collector) const { return toSeconds(periods[collector].load()); }
+
+void CollectorScheduler::setPhase(Collector collector, float seconds) {
+    phases[collector].store(max(toNanos(seconds), 0LL));
+    wake();
+}
+
+float CollectorScheduler::getPhase(Collector collector) const { return toSeconds(phases[collector].load()); }
+
+void CollectorScheduler::start() {
+    // Cadences set before this are already in place; drop their wakeups
+    uint64_t count;
+    while (wakeFd >= 0 && read(wakeFd, &count, sizeof(count)) > 0) {}
+    startTime = now();
+    for (size_t c = 0; c < CollectorCount; c++) {
+        appliedPeriods[c] = periods[c].load();
+        appliedPhases[c] = phases[c].load() % appliedPeriods[c];
+        nextTicks[c] = startTime + appliedPhases[c];
+    }
+}
+
+bool CollectorScheduler::wait(array<bool, CollectorCount>& due, array<long long, CollectorCount>& ticks) {
+    long long time = now();
+    long long earliest = LLONG_MAX;
+    for (size_t c = 0; c < CollectorCount; c++) {
+        long long period = periods[c].load(), phase = phases[c].load() % period;
+        if (period != appliedPeriods[c] || phase != appliedPhases[c]) {
+            // A new cadence starts at its first tick after now on the new grid
+            appliedPeriods[c] = period;
+            appliedPhases[c] = phase;
+            long long origin = startTime + phase;
+            nextTicks[c] = time <= origin ? origin : origin + ((time - origin) / period + 1) * period;
+        }
+        earliest = min(earliest, nextTicks[c]);
+    }
+    if (earliest > time && !sleepUntil(earliest)) return false;
+
+    time = now();
+    bool any = false;
+    for (size_t c = 0; c < CollectorCount; c++) {
+        due[c] = nextTicks[c] <= time;
+        if (!due[c]) continue;
+        any = true;
+        ticks[c] = nextTicks[c];
+        // Skip any ticks a slow collection overran
+        nextTicks[c] += ((time - nextTicks[c]) / appliedPeriods[c] + 1) * appliedPeriods[c];
+    }
+    return any;
+}
+
+bool CollectorScheduler::sleepUntil(long long time) {
+    if (timerFd >= 0) {
+        itimerspec spec{};
+        spec.it_value.tv_sec = time / NanosPerSecond;
+        spec.it_value.tv_nsec = time % NanosPerSecond;
+        timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+    }
+    pollfd fds[2] = {{wakeFd, POLLIN, 0}, {timerFd, POLLIN, 0}};
+    while (true) {
+        // Without a timer the timeout is recomputed after every EINTR, so
+        // signals cannot stretch the wait
+        int timeout = -1;
+        if (timerFd < 0) timeout = (int)max(0LL, (time - now() + 999999) / 1000000); // Rounded up to whole milliseconds
+        int ready = poll(fds, timerFd >= 0 ? 2 : 1, timeout);
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready > 0 && (fds[0].revents & POLLIN)) {
+            uint64_t count;
+            while (read(wakeFd, &count, sizeof(count)) > 0) {}
+            return false;
+        }
+        if (ready > 0 && (fds[1].revents & POLLIN)) {
+            uint64_t expirations;
+            (void)!read(timerFd, &expirations, sizeof(expirations));
+        }
+        return true;
+    }
+}
+
+void CollectorScheduler::wake() {
+    uint64_t one = 1;
+    if (wakeFd >= 0) (void)!write(wakeFd, &one, sizeof(one));
+}
@@ -4,6 +4,8 @@
 #include <pwd.h>
 #include <sstream>
 #include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
 
 string CPUinfo() {
     char CPUBrandString[0x40];
@@ -60,42 +62,6 @@ string getHostname() {
     return "Unknown";
 }
 
-map<char, int> countProcessStates() {
-    map<char, int> processStates;
-    DIR *dir = opendir("/proc");
-    if (!dir) return processStates;
-
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != nullptr) {
-        // Check if the directory name is numeric (PID)
-        if (isdigit(entry->d_name[0])) {
-            string statPath = "/proc/" + string(entry->d_name) + "/stat";
-            ifstream statFile(statPath);
-            if (statFile.is_open()) {
-                string fullStat;
-                getline(statFile, fullStat);
-                size_t statePos = fullStat.find_last_of(")");
-                if (statePos != string::npos && statePos + 2 < fullStat.length()) {
-                    char state = fullStat[statePos + 2];
-                    // Map 'I' (idle) to 'S' (sleeping) to match top's behavior
-                    if (state == 'I') state = 'S';
-                    processStates[state]++;
-                }
-                statFile.close();
-            }
-        }
-    }
-    closedir(dir);
-    return processStates;
-}
-
-int getTotalProcessCount() {
-    map<char, int> states = countProcessStates();
-    int total = 0;
-    for (const auto& pair : states) total += pair.second;
-    return total;
-}
-
 #include <fstream>
 #include <string>
 #include <sstream>
@@ -234,23 +200,84 @@ float getFanSpeed() {
     return 0.0f;
 }
 
+Networks::Networks(const Networks& other) : ip4s(other.ip4s) {
+    for (auto& ip : ip4s) ip.name = strdup(ip.name);
+}
+
+Networks& Networks::operator=(const Networks& other) {
+    if (this != &other) {
+        for (auto& ip : ip4s) free(ip.name);
+        ip4s = other.ip4s;
+        for (auto& ip : ip4s) ip.name = strdup(ip.name);
+    }
+    return *this;
+}
+
+Networks::Networks(Networks&& other) : ip4s(std::move(other.ip4s)) {
+    other.ip4s.clear();
+}
+
+Networks& Networks::operator=(Networks&& other) {
+    if (this != &other) {
+        for (auto& ip : ip4s) free(ip.name);
+        ip4s = std::move(other.ip4s);
+        other.ip4s.clear();
+    }
+    return *this;
+}
+
 Networks::~Networks() {
     for (auto& ip : ip4s) free(ip.name);
 }
 
-CPUUsageTracker::CPUUsageTracker() : lastStats{0}, currentUsage(0.0f) {}
+ProcFile::ProcFile(const char* path) : path(path), fd(-1), buffer(4096), length(0) { buffer[0] = '\0'; }
 
-float CPUUsageTracker::calculateCPUUsage() {
-    ifstream statFile("/proc/stat");
-    string line;
-    getline(statFile, line);
+ProcFile::~ProcFile() {
+    if (fd >= 0) close(fd);
+}
 
+bool ProcFile::read() {
+    // Reopened once if the descriptor went stale
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (fd < 0) fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) break;
+        ssize_t count;
+        while (true) {
+            do {
+                count = pread(fd, buffer.data(), buffer.size() - 1, 0);
+            } while (count < 0 && errno == EINTR);
+            // procfs generates the text on each read; a full buffer may have cut it short
+            if (count < 0 || (size_t)count < buffer.size() - 1) break;
+            buffer.resize(buffer.size() * 2);
+        }
+        if (count >= 0) {
+            length = (size_t)count;
+            buffer[length] = '\0';
+            return true;
+        }
+        close(fd);
+        fd = -1;
+    }
+    length = 0;
+    buffer[0] = '\0';
+    return false;
+}
+
+CPUUsageTracker::CPUUsageTracker() : lastStats{0}, totalTime(0), currentUsage(0.0f) {}
+
+bool CPUUsageTracker::readStats(CPUStats& stats) {
+    stats = CPUStats{};
+    return stat.read() &&
+           sscanf(stat.data(), "cpu %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld",
+                  &stats.user, &stats.nice, &stats.system,
+                  &stats.idle, &stats.iowait, &stats.irq,
+                  &stats.softirq, &stats.steal, &stats.guest,
+                  &stats.guestNice) >= 8;
+}
+
+float CPUUsageTracker::calculateCPUUsage() {
     CPUStats current;
-    sscanf(line.c_str(), "cpu %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld",
-           &current.user, &current.nice, &current.system,
-           &current.idle, &current.iowait, &current.irq,
-           &current.softirq, &current.steal, &current.guest,
-           &current.guestNice);
+    if (!readStats(current)) return currentUsage;
 
     long long prevTotal = lastStats.user + lastStats.nice + lastStats.system +
                           lastStats.idle + lastStats.iowait + lastStats.irq +
@@ -260,6 +287,7 @@ float CPUUsageTracker::calculateCPUUsage() {
                              current.softirq + current.steal;
     long long totalDiff = currentTotal - prevTotal;
     long long idleDiff = current.idle - lastStats.idle;
+    totalTime = currentTotal;
 
     if (totalDiff > 0) {
         currentUsage = 100.0f * (totalDiff - idleDiff) / totalDiff;
@@ -270,66 +298,104 @@ float CPUUsageTracker::calculateCPUUsage() {
 
 float CPUUsageTracker::getCurrentUsage() { return currentUsage; }
 
-ProcessUsageTracker::ProcessUsageTracker()
-    : deltaTime(0.0f), updateInterval(1.0f), lastUpdateTime(0.0f) {}
-
-void ProcessUsageTracker::updateDeltaTime(float dt) {
-    deltaTime += dt; // Accumulate time since last major update
-}
-float ProcessUsageTracker::calculateProcessCPUUsage(const Proc& process, float currentTime) {
-    // Return cached value if not time to update
-    if (currentTime - lastUpdateTime < updateInterval) {
-        auto it = cpuUsageCache.find(process.pid);
-        return (it != cpuUsageCache.end()) ? it->second : 0.0f;
+long long CPUUsageTracker::readTotalTime() {
+    CPUStats current;
+    if (readStats(current)) {
+        totalTime = current.user + current.nice + current.system + current.idle + current.iowait + current.irq +
+                    current.softirq + current.steal;
     }
+    return totalTime;
+}
 
-    // Get number of CPU cores
-    int numCores = sysconf(_SC_NPROCESSORS_ONLN);
+ProcessUsageTracker::ProcessUsageTracker()
+    : entries(MinCapacity, CPUTimeEntry{}), liveCount(0), deletedCount(0), generation(0), numCores(1) {
+    // Get number of CPU cores once; it is needed for every process
+    numCores = sysconf(_SC_NPROCESSORS_ONLN);
     if (numCores <= 0) numCores = 1; // Fallback to 1 core if detection fails
+}
 
-    // Get total system CPU time
-    long long totalTime = 0;
-    ifstream statFile("/proc/stat");
-    if (statFile.is_open()) {
-        string line;
-        getline(statFile, line);
+size_t ProcessUsageTracker::findSlot(int pid) const {
+    // Returns the slot holding pid, or the slot it should be inserted into
+    size_t mask = entries.size() - 1;
+    size_t slot = ((unsigned int)pid * 2654435761u) & mask;
+    size_t firstDeleted = SIZE_MAX;
+    while (true) {
+        int slotPid = entries[slot].pid;
+        if (slotPid == pid) return slot;
+        if (slotPid == EmptySlot) return firstDeleted != SIZE_MAX ? firstDeleted : slot;
+        if (slotPid == DeletedSlot && firstDeleted == SIZE_MAX) firstDeleted = slot;
+        slot = (slot + 1) & mask;
+    }
+}
 
-        long long user, nice, system, idle, iowait, irq, softirq, steal;
-        sscanf(line.c_str(), "cpu %lld %lld %lld %lld %lld %lld %lld %lld",
-               &user, &nice, &system, &idle, &iowait, &irq, &softirq, &steal);
+void ProcessUsageTracker::rehash(size_t expected) {
+    // Size for a load factor of at most 1/2, shrinking as well as growing
+    size_t capacity = MinCapacity;
+    while (capacity < expected * 2) capacity *= 2;
 
-        totalTime = user + nice + system + idle + iowait + irq + softirq + steal;
+    spare.assign(capacity, CPUTimeEntry{});
+    swap(entries, spare);
+    deletedCount = 0;
+    for (const CPUTimeEntry& entry : spare) {
+        if (entry.pid > 0) entries[findSlot(entry.pid)] = entry;
     }
+}
 
-    // Calculate process CPU time (including children if available)
-    long long processCPUTime = process.utime + process.stime; // Add process.cutime + process.cstime if available
+void ProcessUsageTracker::update(const ProcessSnapshot& snapshot, long long totalTime) {
+    generation++;
+
+    // Make room for every process in the snapshot up front (load factor <= 3/4)
+    size_t incoming = snapshot.list.size();
+    if ((liveCount + deletedCount + incoming) * 4 > entries.size() * 3) rehash(liveCount + incoming);
+
+    for (const Proc& process : snapshot.list) {
+        // Calculate process CPU time (including children if available)
+        long long processCPUTime = process.utime + process.stime;
+
+        CPUTimeEntry& entry = entries[findSlot(process.pid)];
+        entry.generation = generation;
+        // If this is the first time we've seen this process (or its PID was reused)
+        if (entry.pid != process.pid || entry.starttime != process.starttime) {
+            if (entry.pid == DeletedSlot) deletedCount--;
+            if (entry.pid != process.pid) liveCount++;
+            entry.pid = process.pid;
+            entry.starttime = process.starttime;
+            entry.lastCPUTime = processCPUTime;
+            entry.lastTotalTime = totalTime;
+            entry.cpuUsage = 0.0f;
+            continue;
+        }
 
-    // If this is the first time we've seen this process
-    if (lastProcessCPUTime.find(process.pid) == lastProcessCPUTime.end()) {
-        lastProcessCPUTime[process.pid] = {processCPUTime, totalTime};
-        cpuUsageCache[process.pid] = 0.0f;
-        lastUpdateTime = currentTime;
-        return 0.0f;
-    }
+        // Calculate deltas
+        long long procTimeDelta = processCPUTime - entry.lastCPUTime;
+        long long totalTimeDelta = totalTime - entry.lastTotalTime;
+
+        // Calculate CPU usage percentage
+        float cpuUsage = 0.0f;
+        if (totalTimeDelta > 0 && procTimeDelta >= 0) {
+            // Normalize to per-core usage and scale by number of cores (like top)
+            cpuUsage = (float)procTimeDelta * 100.0f / totalTimeDelta * numCores;
+            // Cap at 100% per core * number of cores
+            cpuUsage = min(cpuUsage, 100.0f * numCores);
+        }
 
-    // Calculate deltas
-    auto [lastProcTime, lastTotalTime] = lastProcessCPUTime[process.pid];
-    long long procTimeDelta = processCPUTime - lastProcTime;
-    long long totalTimeDelta = totalTime - lastTotalTime;
-
-    // Calculate CPU usage percentage
-    float cpuUsage = 0.0f;
-    if (totalTimeDelta > 0 && procTimeDelta >= 0) {
-        // Normalize to per-core usage and scale by number of cores (like top)
-        cpuUsage = (float)procTimeDelta * 100.0f / totalTimeDelta * numCores;
-        // Cap at 100% per core * number of cores
-        cpuUsage = min(cpuUsage, 100.0f * numCores);
+        // Update cache and last values
+        entry.cpuUsage = cpuUsage;
+        entry.lastCPUTime = processCPUTime;
+        entry.lastTotalTime = totalTime;
     }
 
-    // Update cache and last values
-    cpuUsageCache[process.pid] = cpuUsage;
-    lastProcessCPUTime[process.pid] = {processCPUTime, totalTime};
-    lastUpdateTime = currentTime;
+    // Reclaim processes that were not part of this generation (they exited)
+    for (CPUTimeEntry& entry : entries) {
+        if (entry.pid > 0 && entry.generation != generation) {
+            entry.pid = DeletedSlot;
+            liveCount--;
+            deletedCount++;
+        }
+    }
+}
 
-    return cpuUsage;
+float ProcessUsageTracker::getCPUUsage(int pid) const {
+    const CPUTimeEntry& entry = entries[findSlot(pid)];
+    return entry.pid == pid ? entry.cpuUsage : 0.0f;
 }
@@ -0,0 +1,196 @@
+#include "header.h"
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+
+namespace {
+
+// liburing is not a dependency; these are the three system calls it wraps
+int ioUringSetup(unsigned entries, io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+int ioUringEnter(int ringFd, unsigned submit, unsigned wait, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, ringFd, submit, wait, flags, nullptr, 0);
+}
+
+int ioUringRegister(int ringFd, unsigned opcode, const void* arg, unsigned count) {
+    return (int)syscall(__NR_io_uring_register, ringFd, opcode, arg, count);
+}
+
+// user_data holds the read's index and the step of its chain
+enum ChainStep : uint64_t { StepOpen, StepRead, StepClose };
+
+uint64_t tag(size_t index, ChainStep step) { return (uint64_t)index << 2 | step; }
+
+}
+
+UringReader::UringReader()
+    : ringFd(-1), sqRing(nullptr), sqRingSize(0), cqRing(nullptr), cqRingSize(0), sqes(nullptr), sqesSize(0),
+      sqHead(nullptr), sqTail(nullptr), sqMask(nullptr), sqArray(nullptr), cqHead(nullptr), cqTail(nullptr),
+      cqMask(nullptr), cqes(nullptr), slots(0), enterCalls(0), status("Closed") {}
+
+UringReader::~UringReader() { close(); }
+
+bool UringReader::open(unsigned fileSlots) {
+    close();
+    // Each path takes three entries (open, read, close). SUBMIT_ALL keeps
+    // one bad entry from stranding the rest of a batch in the ring; kernels
+    // too old for it or COOP_TASKRUN (before 5.19) fail here.
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    ringFd = ioUringSetup(fileSlots * 3, &params);
+    if (ringFd < 0) {
+        status = string("io_uring unavailable: ") + strerror(errno);
+        return false;
+    }
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) sqRingSize = cqRingSize = max(sqRingSize, cqRingSize);
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    cqRing = sqRing;
+    if (sqRing != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP))
+        cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* entries = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || entries == MAP_FAILED) {
+        string error = string("io_uring mmap failed: ") + strerror(errno);
+        if (sqRing == MAP_FAILED) sqRing = nullptr;
+        if (cqRing == MAP_FAILED) cqRing = nullptr;
+        if (entries != MAP_FAILED) munmap(entries, sqesSize);
+        close();
+        status = error;
+        return false;
+    }
+    sqes = (io_uring_sqe*)entries;
+
+    char* sq = (char*)sqRing;
+    char* cq = (char*)cqRing;
+    sqHead = (unsigned*)(sq + params.sq_off.head);
+    sqTail = (unsigned*)(sq + params.sq_off.tail);
+    sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    sqArray = (unsigned*)(sq + params.sq_off.array);
+    cqHead = (unsigned*)(cq + params.cq_off.head);
+    cqTail = (unsigned*)(cq + params.cq_off.tail);
+    cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // An empty table of direct descriptors that openat fills and close empties
+    vector<int> table(fileSlots, -1);
+    if (ioUringRegister(ringFd, IORING_REGISTER_FILES, table.data(), fileSlots) < 0) {
+        string error = string("io_uring file table unavailable: ") + strerror(errno);
+        close();
+        status = error;
+        return false;
+    }
+    slots = fileSlots;
+
+    // Older kernels accept the ring but not opening into a slot; find out now
+    char buffer[512];
+    vector<UringRead> probe{{-1, "/proc/self/stat", buffer, sizeof(buffer), 0}};
+    if (!read(probe, AT_FDCWD) || probe[0].result <= 0) {
+        close();
+        status = "io_uring cannot open into registered files (needs Linux 5.19)";
+        return false;
+    }
+    enterCalls = 0;
+    status = "io_uring, " + to_string(slots) + " files per batch";
+    return true;
+}
+
+void UringReader::close() {
+    if (sqes != nullptr) munmap(sqes, sqesSize);
+    if (cqRing != nullptr && cqRing != sqRing) munmap(cqRing, cqRingSize);
+    if (sqRing != nullptr) munmap(sqRing, sqRingSize);
+    if (ringFd >= 0) ::close(ringFd);
+    ringFd = -1;
+    sqRing = cqRing = nullptr;
+    sqes = nullptr;
+    slots = 0;
+    status = "Closed";
+}
+
+bool UringReader::isOpen() const { return ringFd >= 0; }
+
+const string& UringReader::getStatus() const { return status; }
+
+unsigned long long UringReader::getEnterCalls() const { return enterCalls; }
+
+io_uring_sqe* UringReader::queue(unsigned& tail, uint8_t opcode, uint64_t userData) {
+    unsigned index = tail++ & *sqMask;
+    io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->user_data = userData;
+    sqArray[index] = index;
+    return sqe;
+}
+
+bool UringReader::readBatch(UringRead* reads, size_t count, int dirFd) {
+    unsigned tail = *sqTail; // Only this thread moves the tail
+    for (size_t i = 0; i < count; i++) {
+        UringRead& read = reads[i];
+        read.result = -ECANCELED;
+        if (read.fd >= 0) {
+            io_uring_sqe* sqe = queue(tail, IORING_OP_READ, tag(i, StepRead));
+            sqe->fd = read.fd;
+            sqe->addr = (uint64_t)(uintptr_t)read.buffer;
+            sqe->len = read.size;
+            continue;
+        }
+        // open -> read -> close into slot i. A failed open cancels the rest;
+        // the read is hard-linked because a short read also counts as failure.
+        io_uring_sqe* sqe = queue(tail, IORING_OP_OPENAT, tag(i, StepOpen));
+        sqe->fd = dirFd;
+        sqe->addr = (uint64_t)(uintptr_t)read.path;
+        sqe->open_flags = O_RDONLY; // O_CLOEXEC is refused for direct descriptors
+        sqe->file_index = (uint32_t)i + 1;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe = queue(tail, IORING_OP_READ, tag(i, StepRead));
+        sqe->fd = (int)i;
+        sqe->addr = (uint64_t)(uintptr_t)read.buffer;
+        sqe->len = read.size;
+        sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+        sqe = queue(tail, IORING_OP_CLOSE, tag(i, StepClose));
+        sqe->file_index = (uint32_t)i + 1;
+    }
+    unsigned queued = tail - *sqTail;
+    __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+
+    unsigned pending = queued, completed = 0;
+    while (completed < queued) {
+        int submitted = ioUringEnter(ringFd, pending, queued - completed, IORING_ENTER_GETEVENTS);
+        if (submitted < 0 && errno != EINTR) return false;
+        enterCalls++;
+        if (submitted > 0) pending -= min((unsigned)submitted, pending);
+
+        unsigned head = *cqHead;
+        unsigned available = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (; head != available; head++) {
+            const io_uring_cqe& cqe = cqes[head & *cqMask];
+            UringRead& read = reads[cqe.user_data >> 2];
+            ChainStep step = (ChainStep)(cqe.user_data & 3);
+            // A cancelled read keeps the open's error
+            if ((step == StepOpen && cqe.res < 0) || (step == StepRead && cqe.res != -ECANCELED)) read.result = cqe.res;
+            completed++;
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+    return true;
+}
+
+bool UringReader::read(vector<UringRead>& reads, int dirFd) {
+    if (ringFd < 0) return false;
+    for (size_t begin = 0; begin < reads.size(); begin += slots) {
+        if (!readBatch(reads.data() + begin, min<size_t>(slots, reads.size() - begin), dirFd)) {
+            status = string("io_uring_enter failed: ") + strerror(errno);
+            return false;
+        }
+    }
+    return true;
+}